@@ -0,0 +1,800 @@
+//
+//  CodeGenerator.cpp
+//  LexerV1
+//
+//  Created by James Robinson on 12/20/19.
+//
+
+#include "CodeGenerator.h"
+#include "EvaluatingDatabases.h"
+#include <algorithm>
+#include <set>
+#include <sstream>
+
+// MARK: - Runtime
+
+/// The part of every generated program which doesn't depend on the Datalog program it evaluates.
+static const char* const GENERATED_RUNTIME = R"RUNTIME(
+/// A value, interned so that equal values share one address.
+typedef const std::string* Value;
+
+Value intern(const std::string& text) {
+    static std::unordered_set<std::string> symbols = std::unordered_set<std::string>();
+    return &*symbols.insert(text).first;
+}
+
+template <size_t N> using Row = std::array<Value, N>;
+
+template <size_t N> struct RowHash {
+    size_t operator()(const Row<N>& row) const {
+        size_t seed = 0;
+        for (Value value : row) {
+            seed ^= std::hash<Value>()(value) + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2);
+        }
+        return seed;
+    }
+};
+
+/// Orders rows by the text of their values, as the interpreter does.
+template <size_t N> bool precedes(const Row<N>& row, const Row<N>& other) {
+    for (size_t i = 0; i < N; i += 1) {
+        if (row[i] != other[i]) {
+            return *row[i] < *other[i];
+        }
+    }
+    return false;
+}
+
+/// Sorts @c rows by the text of their values, dropping duplicates.
+template <size_t N> void sortRows(std::vector<Row<N>>& rows) {
+    std::sort(rows.begin(), rows.end(), precedes<N>);
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+}
+
+/// The rows of a relation of @c N columns, keyed by the values in @c Columns.
+template <size_t N, size_t... Columns> class Index {
+public:
+    typedef Row<sizeof...(Columns)> Key;
+    std::unordered_multimap<Key, const Row<N>*, RowHash<sizeof...(Columns)>> rows;
+    void add(const Row<N>* row) {
+        rows.emplace(Key{{ (*row)[Columns]... }}, row);
+    }
+    auto find(const Key& key) const {
+        return rows.equal_range(key);
+    }
+};
+
+/// A relation of @c N columns, and the indexes kept on it.
+template <size_t N, typename... Indexes> class Relation {
+public:
+    std::unordered_set<Row<N>, RowHash<N>> rows;
+    /// Every row, in the order it was added.
+    std::vector<const Row<N>*> log;
+    std::tuple<Indexes...> indexes;
+    bool add(const Row<N>& row) {
+        auto inserted = rows.insert(row);
+        if (!inserted.second) {
+            return false;
+        }
+        const Row<N>* stored = &*inserted.first;
+        log.push_back(stored);
+        std::apply([stored](auto&... index) { (index.add(stored), ...); }, indexes);
+        return true;
+    }
+};
+
+/// Writes @c row as a line of trace, naming each value by its column.
+template <size_t N> void appendRow(std::string& output, const Row<N>& row, const std::array<const char*, N>& columns) {
+    output += "  ";
+    for (size_t i = 0; i < N; i += 1) {
+        output += (i == 0) ? "" : ", ";
+        output += columns[i];
+        output += "=";
+        output += *row[i];
+    }
+    output += "\n";
+}
+
+/// Adds @c derived to @c relation, tracing each row which was new to it.
+///
+/// @returns @c true if any row was new.
+template <size_t N, typename... Indexes> bool commitRows(Relation<N, Indexes...>& relation,
+                                                         std::vector<Row<N>>& derived,
+                                                         std::string& output,
+                                                         const std::array<const char*, N>& columns) {
+    sortRows(derived);
+    bool didAdd = false;
+    for (const Row<N>& row : derived) {
+        if (relation.add(row)) {
+            didAdd = true;
+            appendRow(output, row, columns);
+        }
+    }
+    return didAdd;
+}
+
+struct Database;
+void addFact(Database& database, const std::string& name, const std::vector<std::string>& values);
+
+/// Splits Datalog source into identifiers, strings and punctuation, skipping whitespace and comments.
+///
+/// @returns @c false if a string or comment never ends.
+bool readTokens(const std::string& text, std::vector<std::string>& tokens) {
+    size_t i = 0;
+    while (i < text.size()) {
+        char next = text[i];
+        if (std::isspace(static_cast<unsigned char>(next))) {
+            i += 1;
+        } else if (next == '#' && i + 1 < text.size() && text[i + 1] == '|') {
+            size_t end = text.find("|#", i + 2);
+            if (end == std::string::npos) {
+                return false;
+            }
+            i = end + 2;
+        } else if (next == '#') {
+            size_t end = text.find('\n', i);
+            i = (end == std::string::npos) ? text.size() : end;
+        } else if (next == '\'') {
+            // Two quotes in a row are an apostrophe, which doesn't end the string.
+            size_t end = i + 1;
+            while (end < text.size() && (text[end] != '\'' || (end + 1 < text.size() && text[end + 1] == '\''))) {
+                end += (text[end] == '\'') ? 2 : 1;
+            }
+            if (end >= text.size()) {
+                return false;
+            }
+            tokens.push_back(text.substr(i, end - i + 1));
+            i = end + 1;
+        } else if (std::isalpha(static_cast<unsigned char>(next))) {
+            size_t end = i;
+            while (end < text.size() && std::isalnum(static_cast<unsigned char>(text[end]))) {
+                end += 1;
+            }
+            tokens.push_back(text.substr(i, end - i));
+            i = end;
+        } else {
+            tokens.push_back(std::string(1, next));
+            i += 1;
+        }
+    }
+    return true;
+}
+
+/// Adds the facts in the Datalog file at @c path: those in its Facts section, or every statement if it has none.
+///
+/// @returns @c false if the facts could not be read.
+bool readFacts(const char* path, Database& database) {
+    std::ifstream file = std::ifstream(path);
+    std::ostringstream text = std::ostringstream();
+    text << file.rdbuf();
+    std::vector<std::string> tokens = std::vector<std::string>();
+    if (!readTokens(text.str(), tokens)) {
+        std::cerr << "The file '" << path << "' has a string or comment which never ends." << std::endl;
+        return false;
+    }
+    size_t start = 0;
+    size_t end = tokens.size();
+    for (size_t i = 0; i + 1 < tokens.size(); i += 1) {
+        if (tokens[i] == "Facts" && tokens[i + 1] == ":") {
+            start = i + 2;
+        } else if (start > 0 && (tokens[i] == "Rules" || tokens[i] == "Queries") && tokens[i + 1] == ":") {
+            end = i;
+            break;
+        }
+    }
+    size_t i = start;
+    while (i < end) {
+        // name('value',...).
+        std::string name = tokens[i];
+        std::vector<std::string> values = std::vector<std::string>();
+        bool isFact = std::isalpha(static_cast<unsigned char>(name[0])) && i + 1 < end && tokens[i + 1] == "(";
+        i += 2;
+        while (isFact) {
+            isFact = i + 1 < end && tokens[i][0] == '\'';
+            if (!isFact) {
+                break;
+            }
+            values.push_back(tokens[i]);
+            std::string separator = tokens[i + 1];
+            i += 2;
+            if (separator == ")") {
+                break;
+            }
+            isFact = separator == ",";
+        }
+        if (!isFact || i >= end || tokens[i] != ".") {
+            std::cerr << "The file '" << path << "' has a fact which isn't well-formed: " << name << std::endl;
+            return false;
+        }
+        addFact(database, name, values);
+        i += 1;
+    }
+    return true;
+}
+)RUNTIME";
+
+// MARK: - Literals
+
+/// Returns @c text as a C++ string literal.
+std::string stringLiteral(const std::string& text) {
+    std::ostringstream result = std::ostringstream();
+    result << "\"";
+    for (char c : text) {
+        switch (c) {
+            case '"': result << "\\\""; break;
+            case '\\': result << "\\\\"; break;
+            case '\n': result << "\\n"; break;
+            case '\t': result << "\\t"; break;
+            default: result << c; break;
+        }
+    }
+    result << "\"";
+    return result.str();
+}
+
+/// Returns the name of the member of the generated @c Database holding @c relationName.
+std::string relationMember(const std::string& relationName) {
+    return "r_" + relationName;
+}
+
+/// Returns the type of a row of @c columnCount values.
+std::string rowType(size_t columnCount) {
+    return "Row<" + std::to_string(columnCount) + ">";
+}
+
+/// Returns the list of column names of @c scheme, for a @c std::array initializer.
+std::string columnNamesList(const Tuple& scheme) {
+    std::ostringstream result = std::ostringstream();
+    for (size_t i = 0; i < scheme.size(); i += 1) {
+        result << ((i == 0) ? "" : ", ") << stringLiteral(scheme.at(i));
+    }
+    return result.str();
+}
+
+// MARK: - Reading Plans
+
+/// Returns @c true if an operation after @c index reads @c slot.
+bool isSlotRead(const Plan& plan, size_t index, size_t slot) {
+    for (size_t i = index + 1; i < plan.operations.size(); i += 1) {
+        const Operation& operation = plan.operations.at(i);
+        std::vector<Operand> reads = operation.keyValues;
+        reads.insert(reads.end(), operation.values.begin(), operation.values.end());
+        if (operation.kind == OperationKind::Filter) {
+            reads.push_back(operation.value);
+        }
+        for (const auto& operand : reads) {
+            if (operand.kind == Operand::Kind::Slot && operand.index == slot) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/// Returns @c true if an operation after @c index reads a column of row register @c row.
+bool isRowRead(const Plan& plan, size_t index, size_t row) {
+    for (size_t i = index + 1; i < plan.operations.size(); i += 1) {
+        const Operation& operation = plan.operations.at(i);
+        if (operation.row != row) {
+            continue;
+        }
+        if (operation.kind == OperationKind::Filter ||
+            (operation.kind == OperationKind::Project && isSlotRead(plan, i, operation.slot))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// MARK: - Generating
+
+CodeGenerator::CodeGenerator(DatalogProgram* program, Database* database) : compiled(program, database) {
+    this->program = program;
+    this->database = database;
+    this->unsupportedReason = "";
+    
+    for (auto rule : program->getRules()) {
+        const CompiledRule* compiledRule = compiled.compiledRule(rule);
+        if (!compiledRule->isCompiled()) {
+            unsupportedReason = rule->toString() + " could not be compiled: " + compiledRule->getUnsupportedReason();
+            return;
+        }
+        if (!compiledRule->isUnionCompatible()) {
+            unsupportedReason = rule->toString() + " derives columns which don't match "
+                + rule->getHeadPredicate()->getIdentifier();
+            return;
+        }
+        if (compiledRule->alwaysDerivesNothing()) {
+            continue;
+        }
+        
+        collectIndexesAndConstants(compiledRule->getPlan());
+        for (size_t i = 0; i < rule->getPredicates().size(); i += 1) {
+            if (compiledRule->getDeltaPlan(i) != nullptr) {
+                collectIndexesAndConstants(*compiledRule->getDeltaPlan(i));
+            }
+        }
+    }
+    
+    for (auto query : program->getQueries()) {
+        const CompiledQuery* compiledQuery = compiled.compiledQuery(query);
+        if (compiledQuery->isCompiled()) {
+            collectIndexesAndConstants(compiledQuery->getPlan());
+        } else if (database->relationWithName(query->getIdentifier()) != nullptr) {
+            unsupportedReason = query->toString() + " could not be compiled: " + compiledQuery->getUnsupportedReason();
+            return;
+        }
+    }
+}
+
+void CodeGenerator::collectIndexesAndConstants(const Plan& plan) {
+    for (const auto& operation : plan.operations) {
+        if (operation.kind == OperationKind::IndexLookup) {
+            auto& relationIndexes = indexes[operation.relation->getName()];
+            if (std::find(relationIndexes.begin(), relationIndexes.end(), operation.keyColumns) == relationIndexes.end()) {
+                relationIndexes.push_back(operation.keyColumns);
+            }
+        }
+        
+        std::vector<Operand> reads = operation.keyValues;
+        reads.insert(reads.end(), operation.values.begin(), operation.values.end());
+        reads.push_back(operation.value);
+        for (const auto& operand : reads) {
+            if (operand.kind == Operand::Kind::Constant && !operand.constant.empty() &&
+                constants.find(operand.constant) == constants.end()) {
+                constants.insert(std::make_pair(operand.constant, constants.size()));
+            }
+        }
+    }
+}
+
+size_t CodeGenerator::indexNumber(const std::string& relationName, const std::vector<size_t>& keyColumns) const {
+    const auto& relationIndexes = indexes.at(relationName);
+    return static_cast<size_t>(std::find(relationIndexes.begin(), relationIndexes.end(), keyColumns) - relationIndexes.begin());
+}
+
+bool CodeGenerator::canGenerate() const {
+    return unsupportedReason.empty();
+}
+
+std::string CodeGenerator::getUnsupportedReason() const {
+    return unsupportedReason;
+}
+
+std::string CodeGenerator::operandCode(const Operand& operand, size_t row) const {
+    switch (operand.kind) {
+        case Operand::Kind::Constant:
+            return "K" + std::to_string(constants.at(operand.constant));
+        case Operand::Kind::Slot:
+            return "s" + std::to_string(operand.index);
+        case Operand::Kind::Column:
+            return "r" + std::to_string(row) + "[" + std::to_string(operand.index) + "]";
+    }
+    
+    return "";
+}
+
+void CodeGenerator::appendOperations(std::ostringstream& result,
+                                     const Plan& plan,
+                                     size_t index,
+                                     size_t depth,
+                                     const Relation* delta,
+                                     bool countsMatches,
+                                     std::vector<size_t> stoppingLoops) const {
+    const Operation& operation = plan.operations.at(index);
+    std::string indent = std::string(depth * 4, ' ');
+    std::string row = std::to_string(operation.row);
+    
+    switch (operation.kind) {
+        case OperationKind::Scan:
+        case OperationKind::IndexLookup: {
+            const Relation* relation = (operation.relation != nullptr) ? operation.relation : delta;
+            std::string member = "database." + relationMember(relation->getName());
+            std::string type = rowType(relation->getColumnCount());
+            
+            if (operation.stopsAtFirstMatch) {
+                result << indent << "bool found" << row << " = false;" << std::endl;
+                stoppingLoops.push_back(operation.row);
+            }
+            
+            if (operation.kind == OperationKind::IndexLookup) {
+                result << indent << "auto matches" << row << " = std::get<"
+                    << indexNumber(relation->getName(), operation.keyColumns) << ">(" << member << ".indexes).find({{ ";
+                for (size_t k = 0; k < operation.keyValues.size(); k += 1) {
+                    result << ((k == 0) ? "" : ", ") << operandCode(operation.keyValues.at(k), operation.row);
+                }
+                result << " }});" << std::endl;
+                result << indent << "for (auto match" << row << " = matches" << row << ".first; match" << row
+                    << " != matches" << row << ".second; ++match" << row << ") {" << std::endl;
+                if (isRowRead(plan, index, operation.row)) {
+                    result << indent << "    const " << type << "& r" << row << " = *match" << row << "->second;" << std::endl;
+                }
+                
+            } else {
+                bool readsDelta = operation.relation == nullptr;
+                result << indent << "for (size_t i" << row << " = " << (readsDelta ? "begin" : "0") << ", end" << row << " = "
+                    << (readsDelta ? "end" : member + ".log.size()") << "; i" << row << " < end" << row << "; i" << row
+                    << " += 1) {" << std::endl;
+                if (isRowRead(plan, index, operation.row) || !operation.keyColumns.empty()) {
+                    result << indent << "    const " << type << "& r" << row << " = *" << member << ".log[i" << row << "];"
+                        << std::endl;
+                }
+                
+                // The log isn't sorted, so a narrowed scan checks its key columns as it goes.
+                for (size_t k = 0; k < operation.keyColumns.size(); k += 1) {
+                    result << indent << "    if (r" << row << "[" << operation.keyColumns.at(k) << "] != "
+                        << operandCode(operation.keyValues.at(k), operation.row) << ") { continue; }" << std::endl;
+                }
+            }
+            
+            appendOperations(result, plan, index + 1, depth + 1, delta, countsMatches, stoppingLoops);
+            if (operation.stopsAtFirstMatch) {
+                result << indent << "    if (found" << row << ") { break; }" << std::endl;
+            }
+            result << indent << "}" << std::endl;
+            return;
+        }
+        
+        case OperationKind::Filter:
+            result << indent << "if (r" << row << "[" << operation.column << "] == "
+                << operandCode(operation.value, operation.row) << ") {" << std::endl;
+            appendOperations(result, plan, index + 1, depth + 1, delta, countsMatches, stoppingLoops);
+            result << indent << "}" << std::endl;
+            return;
+        
+        case OperationKind::Project:
+            if (isSlotRead(plan, index, operation.slot)) {
+                result << indent << "Value s" << operation.slot << " = r" << row << "[" << operation.column << "];" << std::endl;
+            }
+            appendOperations(result, plan, index + 1, depth, delta, countsMatches, stoppingLoops);
+            return;
+        
+        case OperationKind::Insert:
+            if (countsMatches) {
+                result << indent << "matchCount += 1;" << std::endl;
+            }
+            if (!operation.values.empty()) {
+                result << indent << "output.push_back(" << rowType(operation.values.size()) << "{{ ";
+                for (size_t i = 0; i < operation.values.size(); i += 1) {
+                    result << ((i == 0) ? "" : ", ") << operandCode(operation.values.at(i), operation.row);
+                }
+                result << " }});" << std::endl;
+            }
+            for (auto loop : stoppingLoops) {
+                result << indent << "found" << loop << " = true;" << std::endl;
+            }
+            return;
+    }
+}
+
+void CodeGenerator::appendDatabase(std::ostringstream& result) const {
+    result << "struct Database {" << std::endl;
+    for (auto relation : database->getRelations()) {
+        size_t columnCount = relation->getColumnCount();
+        result << "    Relation<" << columnCount;
+        
+        auto relationIndexes = indexes.find(relation->getName());
+        if (relationIndexes != indexes.end()) {
+            for (const auto& keyColumns : relationIndexes->second) {
+                result << ", Index<" << columnCount;
+                for (auto column : keyColumns) {
+                    result << ", " << column;
+                }
+                result << ">";
+            }
+        }
+        
+        result << "> " << relationMember(relation->getName()) << ";" << std::endl;
+    }
+    result << "};" << std::endl << std::endl;
+    
+    for (auto relation : database->getRelations()) {
+        result << "const std::array<const char*, " << relation->getColumnCount() << "> COLUMNS_" << relation->getName()
+            << " = {{ " << columnNamesList(relation->getScheme()) << " }};" << std::endl;
+    }
+    result << std::endl;
+    
+    std::vector<std::string> constantsInOrder = std::vector<std::string>(constants.size());
+    for (const auto& constant : constants) {
+        constantsInOrder.at(constant.second) = constant.first;
+    }
+    for (size_t i = 0; i < constantsInOrder.size(); i += 1) {
+        result << "const Value K" << i << " = intern(" << stringLiteral(constantsInOrder.at(i)) << ");" << std::endl;
+    }
+    if (!constantsInOrder.empty()) {
+        result << std::endl;
+    }
+}
+
+void CodeGenerator::appendFacts(std::ostringstream& result) const {
+    result << "void addFact(Database& database, const std::string& name, const std::vector<std::string>& values) {" << std::endl;
+    for (auto relation : database->getRelations()) {
+        size_t columnCount = relation->getColumnCount();
+        result << "    if (name == " << stringLiteral(relation->getName()) << " && values.size() == " << columnCount
+            << ") {" << std::endl;
+        result << "        database." << relationMember(relation->getName()) << ".add(" << rowType(columnCount) << "{{ ";
+        for (size_t i = 0; i < columnCount; i += 1) {
+            result << ((i == 0) ? "" : ", ") << "intern(values[" << i << "])";
+        }
+        result << " }});" << std::endl;
+        result << "    }" << std::endl;
+    }
+    result << "}" << std::endl << std::endl;
+    
+    result << "/// Adds the facts given in the program." << std::endl;
+    result << "void addProgramFacts(Database& database) {" << std::endl;
+    bool hasFacts = false;
+    for (auto relation : database->getRelations()) {
+        if (relation->getContents().empty()) {
+            continue;
+        }
+        hasFacts = true;
+        
+        result << "    static const char* const FACTS_" << relation->getName() << "[][" << relation->getColumnCount()
+            << "] = {" << std::endl;
+        for (const Tuple& fact : relation->getContents()) {
+            result << "        { " << columnNamesList(fact) << " }," << std::endl;
+        }
+        result << "    };" << std::endl;
+        result << "    for (const auto& fact : FACTS_" << relation->getName() << ") {" << std::endl;
+        result << "        addFact(database, " << stringLiteral(relation->getName())
+            << ", std::vector<std::string>(std::begin(fact), std::end(fact)));" << std::endl;
+        result << "    }" << std::endl;
+    }
+    if (!hasFacts) {
+        result << "    (void)database;" << std::endl;
+    }
+    result << "}" << std::endl << std::endl;
+}
+
+void CodeGenerator::appendRule(std::ostringstream& result,
+                               int ruleID,
+                               Rule* rule,
+                               const std::vector<std::string>& componentHeads,
+                               bool isRecursive) const {
+    const CompiledRule* compiledRule = compiled.compiledRule(rule);
+    Relation* headRelation = database->relationWithName(rule->getHeadPredicate()->getIdentifier());
+    std::string id = std::to_string(ruleID);
+    std::string type = rowType(headRelation->getColumnCount());
+    std::string seenType = "std::array<size_t, " + std::to_string(componentHeads.size()) + ">";
+    std::vector<Predicate*> body = rule->getPredicates();
+    
+    // The deltas this rule can read, once it has fired: those body predicates whose relations its component writes.
+    std::vector<std::pair<size_t, size_t>> deltaHeads = std::vector<std::pair<size_t, size_t>>();
+    for (size_t i = 0; i < body.size() && isRecursive; i += 1) {
+        auto head = std::find(componentHeads.begin(), componentHeads.end(), body.at(i)->getIdentifier());
+        if (compiledRule->getDeltaPlan(i) != nullptr && head != componentHeads.end()) {
+            deltaHeads.push_back(std::make_pair(i, static_cast<size_t>(head - componentHeads.begin())));
+        }
+    }
+    
+    if (!compiledRule->alwaysDerivesNothing()) {
+        result << "/// " << rule->toString() << std::endl;
+        result << "void deriveRule" << id << "(const Database& database, std::vector<" << type << ">& output) {" << std::endl;
+        appendOperations(result, compiledRule->getPlan(), 0, 1, nullptr, false, std::vector<size_t>());
+        result << "}" << std::endl << std::endl;
+        
+        for (const auto& deltaHead : deltaHeads) {
+            result << "/// " << rule->toString() << " Reads only rows @c begin through @c end of "
+                << body.at(deltaHead.first)->getIdentifier() << " for " << body.at(deltaHead.first)->toString() << "."
+                << std::endl;
+            result << "void deriveRule" << id << "FromDelta" << deltaHead.first
+                << "(const Database& database, size_t begin, size_t end, std::vector<" << type << ">& output) {" << std::endl;
+            const Relation* delta = database->relationWithName(body.at(deltaHead.first)->getIdentifier());
+            appendOperations(result, *compiledRule->getDeltaPlan(deltaHead.first), 0, 1, delta, false, std::vector<size_t>());
+            result << "}" << std::endl << std::endl;
+        }
+    }
+    
+    result << "bool fireRule" << id << "(Database& database, std::string& output";
+    if (isRecursive) {
+        result << ", bool& hasFired, " << seenType << "& seen";
+    }
+    result << ") {" << std::endl;
+    
+    bool readsAnyRelation = false;
+    for (auto predicate : body) {
+        readsAnyRelation = readsAnyRelation || database->relationWithName(predicate->getIdentifier()) != nullptr;
+    }
+    // Rules reading no relation trace without a line break.
+    result << "    output += " << stringLiteral(rule->toString() + (readsAnyRelation ? "\n" : "")) << ";" << std::endl;
+    if (compiledRule->alwaysDerivesNothing()) {
+        if (isRecursive) {
+            result << "    hasFired = true;" << std::endl;
+            result << "    (void)seen;" << std::endl;
+        }
+        result << "    (void)database;" << std::endl;
+        result << "    return false;" << std::endl;
+        result << "}" << std::endl << std::endl;
+        return;
+    }
+    
+    result << "    std::vector<" << type << "> derived = std::vector<" << type << ">();" << std::endl;
+    if (!isRecursive) {
+        result << "    deriveRule" << id << "(database, derived);" << std::endl;
+        
+    } else {
+        // Rows this rule adds become part of its next delta, so take note of where each relation ends before committing.
+        if (!deltaHeads.empty()) {
+            result << "    " << seenType << " from = seen;" << std::endl;
+        }
+        result << "    seen = {{ ";
+        for (size_t h = 0; h < componentHeads.size(); h += 1) {
+            result << ((h == 0) ? "" : ", ") << "database." << relationMember(componentHeads.at(h)) << ".log.size()";
+        }
+        result << " }};" << std::endl;
+        result << "    if (!hasFired) {" << std::endl;
+        result << "        hasFired = true;" << std::endl;
+        result << "        deriveRule" << id << "(database, derived);" << std::endl;
+        result << "    } else {" << std::endl;
+        for (const auto& deltaHead : deltaHeads) {
+            std::string h = std::to_string(deltaHead.second);
+            result << "        if (from[" << h << "] < seen[" << h << "]) {" << std::endl;
+            result << "            deriveRule" << id << "FromDelta" << deltaHead.first << "(database, from[" << h << "], seen["
+                << h << "], derived);" << std::endl;
+            result << "        }" << std::endl;
+        }
+        result << "    }" << std::endl;
+    }
+    result << "    return commitRows(database." << relationMember(headRelation->getName()) << ", derived, output, COLUMNS_"
+        << headRelation->getName() << ");" << std::endl;
+    result << "}" << std::endl << std::endl;
+}
+
+void CodeGenerator::appendQuery(std::ostringstream& result, size_t queryIndex) const {
+    Predicate* query = program->getQueries().at(queryIndex);
+    const CompiledQuery* compiledQuery = compiled.compiledQuery(query);
+    
+    result << "/// " << query->toString() << std::endl;
+    result << "void answerQuery" << queryIndex << "(const Database& database, std::string& answers) {" << std::endl;
+    result << "    answers += " << stringLiteral(query->toString() + " ") << ";" << std::endl;
+    
+    if (!compiledQuery->isCompiled()) {
+        // Queries of relations which don't exist find nothing.
+        result << "    (void)database;" << std::endl;
+        result << "    answers += \"No\\n\";" << std::endl;
+        result << "}" << std::endl << std::endl;
+        return;
+    }
+    
+    const Tuple& variables = compiledQuery->getVariables();
+    std::string type = rowType(variables.size());
+    result << "    size_t matchCount = 0;" << std::endl;
+    if (!variables.empty()) {
+        result << "    std::vector<" << type << "> output = std::vector<" << type << ">();" << std::endl;
+    }
+    appendOperations(result, compiledQuery->getPlan(), 0, 1, nullptr, true, std::vector<size_t>());
+    
+    result << "    answers += (matchCount == 0) ? \"No\\n\" : \"Yes(\" + std::to_string(matchCount) + \")\\n\";" << std::endl;
+    if (!variables.empty()) {
+        result << "    sortRows(output);" << std::endl;
+        result << "    for (const " << type << "& row : output) {" << std::endl;
+        result << "        appendRow(answers, row, {{ " << columnNamesList(variables) << " }});" << std::endl;
+        result << "    }" << std::endl;
+    }
+    result << "}" << std::endl << std::endl;
+}
+
+std::string CodeGenerator::generatedSource() const {
+    std::ostringstream result = std::ostringstream();
+    
+    result << "//" << std::endl;
+    result << "//  Generated by LexerV1. Evaluates a single Datalog program, printing what LexerV1 would." << std::endl;
+    result << "//" << std::endl;
+    result << "//  Build with a C++17 compiler, such as: c++ -std=c++17 -O2 -o program program.cpp" << std::endl;
+    result << "//  Run with the path of a Datalog file whose facts to use, or with none to use the program's own." << std::endl;
+    result << "//" << std::endl << std::endl;
+    
+    for (auto header : { "algorithm", "array", "cctype", "fstream", "functional", "iostream", "iterator", "sstream", "string",
+                         "tuple", "unordered_map", "unordered_set", "vector" }) {
+        result << "#include <" << header << ">" << std::endl;
+    }
+    result << std::endl << "namespace {" << std::endl;
+    result << GENERATED_RUNTIME << std::endl;
+    
+    appendDatabase(result);
+    appendFacts(result);
+    
+    DependencyGraph* dependencies = buildDependencyGraph(program);
+    vector<DependencyGraph> components = stronglyConnectedComponentsFromGraph(*dependencies);
+    
+    // Each component's rules, in order, whether they recur, and the relations they write.
+    std::ostringstream evaluation = std::ostringstream();
+    for (const auto& component : components) {
+        std::string vertices = component.verticesByIDToString();
+        evaluation << "    // SCC: " << vertices << std::endl;
+        evaluation << "    output += " << stringLiteral("SCC: " + vertices + "\n") << ";" << std::endl;
+        
+        if (component.getNodes().empty()) {
+            evaluation << "    output += " << stringLiteral("0 passes: " + vertices + "\n") << ";" << std::endl;
+            continue;
+        }
+        
+        bool isRecursive = true;
+        if (component.getNodes().size() == 1) {
+            int id = component.getNodes().begin()->first;
+            auto adjacencies = dependencies->getNodes().at(id).getAdjacencies();
+            isRecursive = adjacencies.find(id) != adjacencies.end();
+        }
+        
+        std::set<std::string> heads = std::set<std::string>();
+        for (const auto& node : component.getNodes()) {
+            heads.insert(node.second.getPrimaryRule()->getHeadPredicate()->getIdentifier());
+        }
+        std::vector<std::string> componentHeads = std::vector<std::string>(heads.begin(), heads.end());
+        
+        for (const auto& node : component.getNodes()) {
+            appendRule(result, node.first, node.second.getPrimaryRule(), componentHeads, isRecursive);
+        }
+        
+        if (!isRecursive) {
+            evaluation << "    fireRule" << component.getNodes().begin()->first << "(database, output);" << std::endl;
+            evaluation << "    output += " << stringLiteral("1 passes: " + vertices + "\n") << ";" << std::endl;
+            continue;
+        }
+        
+        evaluation << "    {" << std::endl;
+        evaluation << "        int passCount = 0;" << std::endl;
+        for (const auto& node : component.getNodes()) {
+            evaluation << "        bool hasFired" << node.first << " = false;" << std::endl;
+            evaluation << "        std::array<size_t, " << componentHeads.size() << "> seen" << node.first << " = {};" << std::endl;
+        }
+        evaluation << "        bool didAddToDatabase = true;" << std::endl;
+        evaluation << "        while (didAddToDatabase) {" << std::endl;
+        evaluation << "            didAddToDatabase = false;" << std::endl;
+        for (const auto& node : component.getNodes()) {
+            std::string id = std::to_string(node.first);
+            evaluation << "            if (fireRule" << id << "(database, output, hasFired" << id << ", seen" << id << ")) {" << std::endl;
+            evaluation << "                didAddToDatabase = true;" << std::endl;
+            evaluation << "            }" << std::endl;
+        }
+        evaluation << "            passCount += 1;" << std::endl;
+        evaluation << "        }" << std::endl;
+        evaluation << "        output += std::to_string(passCount) + " << stringLiteral(" passes: " + vertices + "\n") << ";"
+            << std::endl;
+        evaluation << "    }" << std::endl;
+    }
+    
+    for (size_t i = 0; i < program->getQueries().size(); i += 1) {
+        appendQuery(result, i);
+    }
+    result << "} // namespace" << std::endl << std::endl;
+    
+    result << "int main(int argc, char* argv[]) {" << std::endl;
+    result << "    Database database = Database();" << std::endl;
+    result << "    if (argc > 1) {" << std::endl;
+    result << "        std::ifstream file = std::ifstream(argv[1]);" << std::endl;
+    result << "        if (!file.is_open()) {" << std::endl;
+    result << "            std::cout << \"The file '\" << argv[1] << \"' could not be opened.\" << std::endl;" << std::endl;
+    result << "            return 0;" << std::endl;
+    result << "        }" << std::endl;
+    result << "        if (!readFacts(argv[1], database)) {" << std::endl;
+    result << "            return 1;" << std::endl;
+    result << "        }" << std::endl;
+    result << "    } else {" << std::endl;
+    result << "        addProgramFacts(database);" << std::endl;
+    result << "    }" << std::endl << std::endl;
+    
+    result << "    std::string output = std::string();" << std::endl;
+    result << "    output += " << stringLiteral("Dependency Graph\n" + dependencies->toString() + "\n") << ";" << std::endl;
+    result << "    output += \"Rule Evaluation\\n\";" << std::endl;
+    result << evaluation.str();
+    result << "    output += \"\\n\";" << std::endl << std::endl;
+    
+    result << "    std::string answers = \"Query Evaluation\\n\";" << std::endl;
+    for (size_t i = 0; i < program->getQueries().size(); i += 1) {
+        result << "    answerQuery" << i << "(database, answers);" << std::endl;
+    }
+    result << "    while (!answers.empty() && std::isspace(static_cast<unsigned char>(answers.back()))) {" << std::endl;
+    result << "        answers.pop_back();" << std::endl;
+    result << "    }" << std::endl;
+    result << "    output += answers;" << std::endl << std::endl;
+    
+    result << "    std::cout << output << std::endl;" << std::endl;
+    result << "    return 0;" << std::endl;
+    result << "}" << std::endl;
+    
+    delete dependencies;
+    
+    return result.str();
+}
@@ -0,0 +1,84 @@
+//
+//  CodeGenerator.h
+//  LexerV1
+//
+//  Created by James Robinson on 12/20/19.
+//
+
+#ifndef CodeGenerator_h
+#define CodeGenerator_h
+
+#include <string>
+#include <vector>
+#include <map>
+#include "Database.h"
+#include "DatalogProgram.h"
+#include "CompiledProgram.h"
+
+/// Writes a standalone C++ program which evaluates one Datalog program, printing what @c main would.
+///
+/// Each relation becomes a @c Relation template instance specialized by its arity and the indexes its rules look it up by,
+/// and each compiled plan becomes a nest of loops over those. Values are interned, so the generated code compares them by
+/// address, and no column is matched by name.
+class CodeGenerator {
+private:
+    DatalogProgram* program;
+    Database* database;
+    CompiledProgram compiled;
+    
+    /// Why the program could not be generated, or empty if it can be.
+    std::string unsupportedReason;
+    
+    /// The key columns of each index kept on each relation, in the order they are declared.
+    std::map<std::string, std::vector<std::vector<size_t>>> indexes;
+    /// Each constant the plans read, numbered in the order they first appear.
+    std::map<std::string, size_t> constants;
+    
+    void collectIndexesAndConstants(const Plan& plan);
+    
+    /// Returns the position of the index on @c relationName keyed by @c keyColumns among those declared for it.
+    size_t indexNumber(const std::string& relationName, const std::vector<size_t>& keyColumns) const;
+    
+    std::string operandCode(const Operand& operand, size_t row) const;
+    
+    /// Writes the operations of @c plan from @c index onward, nested @c depth levels deep.
+    ///
+    /// @param delta The relation whose rows between @c begin and @c end a loop without a relation of its own reads.
+    /// @param countsMatches Whether the insert counts each match in @c matchCount.
+    /// @param stoppingLoops The rows of the enclosing loops which stop at their first match.
+    void appendOperations(std::ostringstream& result,
+                          const Plan& plan,
+                          size_t index,
+                          size_t depth,
+                          const Relation* delta,
+                          bool countsMatches,
+                          std::vector<size_t> stoppingLoops) const;
+    
+    void appendDatabase(std::ostringstream& result) const;
+    void appendFacts(std::ostringstream& result) const;
+    
+    /// Writes the functions which derive and fire the rule numbered @c ruleID.
+    ///
+    /// @param componentHeads The relations the rules of the rule's component write, whose new rows it reads as deltas.
+    void appendRule(std::ostringstream& result,
+                    int ruleID,
+                    Rule* rule,
+                    const std::vector<std::string>& componentHeads,
+                    bool isRecursive) const;
+    void appendQuery(std::ostringstream& result, size_t queryIndex) const;
+    
+public:
+    CodeGenerator(DatalogProgram* program, Database* database);
+    
+    /// Returns @c true if the program can be generated. Programs whose rules or queries could not be compiled, or whose rules
+    /// derive rows which don't fit their head relations, cannot.
+    bool canGenerate() const;
+    
+    std::string getUnsupportedReason() const;
+    
+    /// Returns the source of the generated program, which reads its facts from the Datalog file named by its first argument,
+    /// or uses the program's own facts if there is none.
+    std::string generatedSource() const;
+};
+
+#endif /* CodeGenerator_h */
@@ -0,0 +1,1037 @@
+//
+//  CompiledProgram.cpp
+//  LexerV1
+//
+//  Created by James Robinson on 12/18/19.
+//
+
+#include "CompiledProgram.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <set>
+#include <unordered_map>
+
+// MARK: - Operands
+
+Operand Operand::constantValue(const std::string& value) {
+    Operand result = Operand();
+    result.kind = Kind::Constant;
+    result.constant = value;
+    return result;
+}
+
+Operand Operand::slot(size_t slot) {
+    Operand result = Operand();
+    result.kind = Kind::Slot;
+    result.index = slot;
+    return result;
+}
+
+Operand Operand::column(size_t column) {
+    Operand result = Operand();
+    result.kind = Kind::Column;
+    result.index = column;
+    return result;
+}
+
+/// Describes @c operand as read by an operation on row register @c row.
+std::string stringForOperand(const Operand& operand, size_t row, const std::vector<std::string>& slotNames) {
+    switch (operand.kind) {
+        case Operand::Kind::Constant:
+            return operand.constant;
+        case Operand::Kind::Slot:
+            return "$" + std::to_string(operand.index) + " " + slotNames.at(operand.index);
+        case Operand::Kind::Column:
+            return "#" + std::to_string(row) + "[" + std::to_string(operand.index) + "]";
+    }
+    
+    return "";
+}
+
+// MARK: - Running Plans
+
+/// How many rows of a plan's outermost loop each thread takes at a time.
+static const size_t SCAN_CHUNK_ROWS = 4096;
+
+/// Mixes the hash of @c value into @c seed.
+static size_t hashCombining(size_t seed, const std::string& value) {
+    return seed ^ (std::hash<std::string>()(value) + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2));
+}
+
+/// The registers of one run through a plan.
+struct PlanState {
+    const Plan* plan;
+    const Relation* delta;
+    const std::vector<const LookupIndex*>* indexes;
+    std::vector<const Tuple*> rows;
+    std::vector<const std::string*> slots;
+    std::vector<Tuple> output;
+    size_t matchCount;
+};
+
+static const std::string& valueOfOperand(const Operand& operand, const PlanState& state, size_t row) {
+    switch (operand.kind) {
+        case Operand::Kind::Constant:
+            return operand.constant;
+        case Operand::Kind::Slot:
+            return *state.slots[operand.index];
+        case Operand::Kind::Column:
+            return (*state.rows[row])[operand.index];
+    }
+    
+    return operand.constant;
+}
+
+static bool runOperation(PlanState& state, size_t index);
+
+/// Returns the first and past-the-last of @c rows which @c scan loops over: all of them, or those whose leading columns hold
+/// its key values, which it only takes as constants.
+static std::pair<std::set<Tuple>::const_iterator, std::set<Tuple>::const_iterator> rangeOfScan(const Operation& scan,
+                                                                                               const std::set<Tuple>& rows) {
+    if (scan.keyColumns.empty()) {
+        return std::make_pair(rows.begin(), rows.end());
+    }
+    
+    // Rows sort by their leading columns first, so a row starting with the key sorts before any which extend it.
+    Tuple key = Tuple();
+    for (const auto& value : scan.keyValues) {
+        key.push_back(value.constant);
+    }
+    
+    auto first = rows.lower_bound(key);
+    auto last = first;
+    while (last != rows.end() && std::equal(key.begin(), key.end(), last->begin())) {
+        ++last;
+    }
+    return std::make_pair(first, last);
+}
+
+/// Runs what follows the loop at @c index for one of its rows.
+///
+/// @returns @c true if the row reached the end of the plan.
+static bool visitRow(PlanState& state, size_t index, const Tuple& row) {
+    state.rows[state.plan->operations[index].row] = &row;
+    return runOperation(state, index + 1);
+}
+
+/// Runs the operation at @c index, and everything nested within it.
+///
+/// @returns @c true if anything reached the end of the plan.
+static bool runOperation(PlanState& state, size_t index) {
+    const Operation& operation = state.plan->operations[index];
+    
+    switch (operation.kind) {
+        case OperationKind::Scan: {
+            const Relation* relation = (operation.relation != nullptr) ? operation.relation : state.delta;
+            auto rows = rangeOfScan(operation, relation->getContents());
+            bool didMatch = false;
+            for (auto row = rows.first; row != rows.second; ++row) {
+                if (visitRow(state, index, *row)) {
+                    didMatch = true;
+                    if (operation.stopsAtFirstMatch) { break; }
+                }
+            }
+            return didMatch;
+        }
+        
+        case OperationKind::IndexLookup: {
+            size_t hash = 0;
+            for (const auto& key : operation.keyValues) {
+                hash = hashCombining(hash, valueOfOperand(key, state, operation.row));
+            }
+            
+            bool didMatch = false;
+            auto matches = state.indexes->at(index)->equal_range(hash);
+            for (auto match = matches.first; match != matches.second; ++match) {
+                const Tuple& row = *match->second;
+                
+                bool isMatch = true;
+                for (size_t k = 0; k < operation.keyColumns.size() && isMatch; k += 1) {
+                    isMatch = row[operation.keyColumns[k]] == valueOfOperand(operation.keyValues[k], state, operation.row);
+                }
+                if (!isMatch) {
+                    continue; // Hashes collided, but the values differ.
+                }
+                
+                if (visitRow(state, index, row)) {
+                    didMatch = true;
+                    if (operation.stopsAtFirstMatch) { break; }
+                }
+            }
+            return didMatch;
+        }
+        
+        case OperationKind::Filter: {
+            const Tuple& row = *state.rows[operation.row];
+            if (row[operation.column] != valueOfOperand(operation.value, state, operation.row)) {
+                return false;
+            }
+            return runOperation(state, index + 1);
+        }
+        
+        case OperationKind::Project: {
+            state.slots[operation.slot] = &(*state.rows[operation.row])[operation.column];
+            return runOperation(state, index + 1);
+        }
+        
+        case OperationKind::Insert: {
+            Tuple row = Tuple();
+            row.reserve(operation.values.size());
+            for (const auto& value : operation.values) {
+                row.push_back(valueOfOperand(value, state, operation.row));
+            }
+            state.output.push_back(std::move(row));
+            state.matchCount += 1;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+/// Returns the hash of the columns of @c row which @c keyColumns name.
+static size_t hashOfKey(const Tuple& row, const std::vector<size_t>& keyColumns) {
+    size_t hash = 0;
+    for (auto col : keyColumns) {
+        hash = hashCombining(hash, row[col]);
+    }
+    return hash;
+}
+
+std::vector<Tuple> Plan::run(const Relation* delta, size_t* matchCount, const MaintainedIndexes* maintained) const {
+    if (matchCount != nullptr) {
+        *matchCount = 0;
+    }
+    if (operations.empty()) {
+        return std::vector<Tuple>();
+    }
+    
+    // Index each relation we look into, once for the whole run, unless its index is kept for us.
+    std::vector<LookupIndex> builtIndexes = std::vector<LookupIndex>(operations.size());
+    std::vector<const LookupIndex*> indexes = std::vector<const LookupIndex*>(operations.size(), nullptr);
+    for (size_t i = 0; i < operations.size(); i += 1) {
+        const Operation& operation = operations.at(i);
+        if (operation.kind != OperationKind::IndexLookup) {
+            continue;
+        }
+        
+        if (maintained != nullptr && operation.relation != nullptr) {
+            indexes.at(i) = maintained->indexFor(operation.relation, operation.keyColumns);
+            if (indexes.at(i) != nullptr) {
+                continue;
+            }
+        }
+        
+        const Relation* relation = (operation.relation != nullptr) ? operation.relation : delta;
+        builtIndexes.at(i).reserve(relation->getContents().size());
+        for (const Tuple& row : relation->getContents()) {
+            builtIndexes.at(i).insert(std::make_pair(hashOfKey(row, operation.keyColumns), &row));
+        }
+        indexes.at(i) = &builtIndexes.at(i);
+    }
+    
+    // Split the outermost loop into ranges of rows, which run on their own threads.
+    const Operation& outer = operations.front();
+    const Relation* outerRelation = (outer.relation != nullptr) ? outer.relation : delta;
+    auto outerRows = rangeOfScan(outer, outerRelation->getContents());
+    
+    // Only a narrowed scan needs counting to know whether it's worth splitting.
+    bool isLarge = !outer.keyColumns.empty() || outerRelation->getContents().size() > SCAN_CHUNK_ROWS;
+    std::vector<std::set<Tuple>::const_iterator> rangeStarts = { outerRows.first };
+    if (isLarge && ThreadPool::shared().getThreadCount() > 1) {
+        size_t rowIndex = 0;
+        for (auto row = outerRows.first; row != outerRows.second; ++row) {
+            if (rowIndex > 0 && rowIndex % SCAN_CHUNK_ROWS == 0) {
+                rangeStarts.push_back(row);
+            }
+            rowIndex += 1;
+        }
+    }
+    rangeStarts.push_back(outerRows.second);
+    
+    PlanState initialState = PlanState();
+    initialState.plan = this;
+    initialState.delta = delta;
+    initialState.indexes = &indexes;
+    initialState.rows = std::vector<const Tuple*>(rowCount, nullptr);
+    initialState.slots = std::vector<const std::string*>(slotCount, nullptr);
+    initialState.matchCount = 0;
+    std::vector<PlanState> states = std::vector<PlanState>(rangeStarts.size() - 1, initialState);
+    
+    auto runRange = [&](size_t range) {
+        PlanState& state = states.at(range);
+        for (auto row = rangeStarts.at(range); row != rangeStarts.at(range + 1); ++row) {
+            if (visitRow(state, 0, *row) && outer.stopsAtFirstMatch) {
+                break;
+            }
+        }
+    };
+    
+    if (states.size() > 1) {
+        ThreadPool::shared().parallelFor(states.size(), runRange);
+    } else {
+        runRange(0);
+    }
+    
+    // Gather everything in range order, then sort once.
+    std::vector<Tuple> result = std::move(states.front().output);
+    for (size_t i = 1; i < states.size(); i += 1) {
+        result.insert(result.end(),
+                      std::make_move_iterator(states.at(i).output.begin()),
+                      std::make_move_iterator(states.at(i).output.end()));
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    
+    if (matchCount != nullptr) {
+        for (const auto& state : states) {
+            *matchCount += state.matchCount;
+        }
+    }
+    
+    return result;
+}
+
+std::string Plan::toString(const std::vector<std::string>& slotNames, size_t indent) const {
+    std::ostringstream result = std::ostringstream();
+    
+    size_t depth = indent;
+    for (const auto& operation : operations) {
+        result << std::string(depth, ' ');
+        
+        switch (operation.kind) {
+            case OperationKind::Scan:
+            case OperationKind::IndexLookup: {
+                std::string name = (operation.relation != nullptr) ? operation.relation->getName() : "delta";
+                bool isLookup = operation.kind == OperationKind::IndexLookup;
+                result << (isLookup ? "lookup " : "scan ") << name << " as #" << operation.row;
+                
+                for (size_t k = 0; k < operation.keyColumns.size(); k += 1) {
+                    result << ((k == 0) ? " where " : ", ");
+                    result << "[" << operation.keyColumns.at(k) << "] = ";
+                    result << stringForOperand(operation.keyValues.at(k), operation.row, slotNames);
+                }
+                if (operation.stopsAtFirstMatch) {
+                    result << " (first match only)";
+                }
+                
+                depth += 2;
+                break;
+            }
+            
+            case OperationKind::Filter:
+                result << "filter #" << operation.row << "[" << operation.column << "] = ";
+                result << stringForOperand(operation.value, operation.row, slotNames);
+                break;
+            
+            case OperationKind::Project:
+                result << "project #" << operation.row << "[" << operation.column << "] into ";
+                result << stringForOperand(Operand::slot(operation.slot), operation.row, slotNames);
+                break;
+            
+            case OperationKind::Insert:
+                result << "insert (";
+                for (size_t i = 0; i < operation.values.size(); i += 1) {
+                    result << ((i == 0) ? "" : ", ");
+                    result << stringForOperand(operation.values.at(i), operation.row, slotNames);
+                }
+                result << ")";
+                break;
+        }
+        
+        result << std::endl;
+    }
+    
+    return result.str();
+}
+
+// MARK: - Maintained Indexes
+
+void MaintainedIndexes::addIndexesFor(const Plan& plan) {
+    for (const auto& operation : plan.operations) {
+        if (operation.kind != OperationKind::IndexLookup || operation.relation == nullptr) {
+            continue;
+        }
+        
+        auto key = std::make_pair(operation.relation, operation.keyColumns);
+        if (indexes.find(key) != indexes.end()) {
+            continue;
+        }
+        
+        LookupIndex& index = indexes[key];
+        index.reserve(operation.relation->getContents().size());
+        for (const Tuple& row : operation.relation->getContents()) {
+            index.insert(std::make_pair(hashOfKey(row, operation.keyColumns), &row));
+        }
+    }
+}
+
+const LookupIndex* MaintainedIndexes::indexFor(const Relation* relation, const std::vector<size_t>& keyColumns) const {
+    auto index = indexes.find(std::make_pair(relation, keyColumns));
+    if (index == indexes.end()) {
+        return nullptr;
+    }
+    return &index->second;
+}
+
+void MaintainedIndexes::rowAdded(const Relation* relation, const Tuple* row) {
+    // Indexes are ordered by relation first, so those on this one sit together.
+    for (auto index = indexes.lower_bound(std::make_pair(relation, std::vector<size_t>()));
+         index != indexes.end() && index->first.first == relation;
+         ++index) {
+        index->second.insert(std::make_pair(hashOfKey(*row, index->first.second), row));
+    }
+}
+
+void MaintainedIndexes::rowRemoving(const Relation* relation, const Tuple* row) {
+    for (auto index = indexes.lower_bound(std::make_pair(relation, std::vector<size_t>()));
+         index != indexes.end() && index->first.first == relation;
+         ++index) {
+        auto matches = index->second.equal_range(hashOfKey(*row, index->first.second));
+        for (auto match = matches.first; match != matches.second; ++match) {
+            if (match->second == row) {
+                index->second.erase(match);
+                break;
+            }
+        }
+    }
+}
+
+// MARK: - Compiling
+
+/// What a predicate asks of each column of its relation, worked out the same way @c evaluateQueryItem does.
+struct PredicateShape {
+    /// Columns which must hold a constant.
+    std::vector<std::pair<size_t, std::string>> constants = {};
+    /// Columns which must all hold the same value. @c evaluateQueryItem selects these as a single group.
+    std::vector<size_t> equalColumns = {};
+    /// Each variable, and the first column it appears in.
+    std::vector<std::pair<std::string, size_t>> variables = {};
+};
+
+PredicateShape shapeOfPredicate(Predicate* predicate) {
+    PredicateShape shape = PredicateShape();
+    std::vector<std::string> items = predicate->getItems();
+    std::vector<std::string> processedOperands = {};
+    
+    for (size_t col = 0; col < items.size(); col += 1) {
+        std::string val = items.at(col);
+        
+        if (val.at(0) == '\'') {
+            shape.constants.push_back(std::make_pair(col, val));
+            continue;
+        }
+        
+        // Repeats are matched against the position of the variable's first appearance among the variables.
+        auto processed = std::find(processedOperands.begin(), processedOperands.end(), val);
+        if (processed != processedOperands.end()) {
+            shape.equalColumns.push_back(col);
+            shape.equalColumns.push_back(static_cast<size_t>(processed - processedOperands.begin()));
+        } else {
+            processedOperands.push_back(val);
+            shape.variables.push_back(std::make_pair(val, col));
+        }
+    }
+    
+    return shape;
+}
+
+/// Returns why a compiled plan couldn't read @c relation for @c predicate just as @c evaluateQueryItem would,
+/// or an empty string if it could.
+std::string unsupportedRelationReason(Predicate* predicate, const Relation* relation) {
+    if (relation->getColumnCount() == 0) {
+        return relation->getName() + " has no columns";
+    }
+    if (relation->getColumnCount() != predicate->getItems().size()) {
+        return relation->getName() + " has " + std::to_string(relation->getColumnCount()) + " columns, but "
+            + predicate->toString() + " names " + std::to_string(predicate->getItems().size());
+    }
+    
+    std::set<std::string> columns = std::set<std::string>(relation->getScheme().begin(), relation->getScheme().end());
+    if (columns.size() != relation->getColumnCount()) {
+        return relation->getName() + " repeats a column name";
+    }
+    
+    return "";
+}
+
+/// Adds to @c plan a loop over @c relation, then the filters and projections @c shape asks for.
+///
+/// Variables already bound become lookup keys, as do constants unless this is the outermost loop. There, constants in the
+/// leading columns narrow the scan to the rows holding them instead, and the rest are filtered.
+void appendPredicateToPlan(Plan& plan,
+                           const Relation* relation,
+                           const PredicateShape& shape,
+                           const std::map<std::string, size_t>& slotIndexes,
+                           std::vector<bool>& isBound) {
+    size_t row = plan.rowCount;
+    plan.rowCount += 1;
+    
+    Operation loop = Operation();
+    loop.relation = relation;
+    loop.row = row;
+    if (row > 0) {
+        for (const auto& constant : shape.constants) {
+            loop.keyColumns.push_back(constant.first);
+            loop.keyValues.push_back(Operand::constantValue(constant.second));
+        }
+        for (const auto& variable : shape.variables) {
+            size_t slot = slotIndexes.at(variable.first);
+            if (isBound.at(slot)) {
+                loop.keyColumns.push_back(variable.second);
+                loop.keyValues.push_back(Operand::slot(slot));
+            }
+        }
+        loop.kind = loop.keyColumns.empty() ? OperationKind::Scan : OperationKind::IndexLookup;
+    } else {
+        for (const auto& constant : shape.constants) {
+            if (constant.first != loop.keyColumns.size()) {
+                break;
+            }
+            loop.keyColumns.push_back(constant.first);
+            loop.keyValues.push_back(Operand::constantValue(constant.second));
+        }
+        loop.kind = OperationKind::Scan;
+    }
+    plan.operations.push_back(loop);
+    
+    if (row == 0) {
+        for (size_t i = loop.keyColumns.size(); i < shape.constants.size(); i += 1) {
+            const auto& constant = shape.constants.at(i);
+            Operation filter = Operation();
+            filter.kind = OperationKind::Filter;
+            filter.row = row;
+            filter.column = constant.first;
+            filter.value = Operand::constantValue(constant.second);
+            plan.operations.push_back(filter);
+        }
+    }
+    
+    for (size_t i = 1; i < shape.equalColumns.size(); i += 1) {
+        Operation filter = Operation();
+        filter.kind = OperationKind::Filter;
+        filter.row = row;
+        filter.column = shape.equalColumns.at(i);
+        filter.value = Operand::column(shape.equalColumns.front());
+        plan.operations.push_back(filter);
+    }
+    
+    for (const auto& variable : shape.variables) {
+        size_t slot = slotIndexes.at(variable.first);
+        if (isBound.at(slot)) {
+            continue;
+        }
+        
+        Operation project = Operation();
+        project.kind = OperationKind::Project;
+        project.row = row;
+        project.column = variable.second;
+        project.slot = slot;
+        plan.operations.push_back(project);
+        isBound.at(slot) = true;
+    }
+}
+
+/// Lets each loop of @c plan stop at its first match if nothing after it reads the slots it fills.
+void markExistenceChecks(Plan& plan) {
+    for (size_t i = 0; i < plan.operations.size(); i += 1) {
+        Operation& loop = plan.operations.at(i);
+        if (loop.kind != OperationKind::Scan && loop.kind != OperationKind::IndexLookup) {
+            continue;
+        }
+        
+        std::set<size_t> filled = std::set<size_t>();
+        bool isRead = false;
+        for (size_t j = i + 1; j < plan.operations.size() && !isRead; j += 1) {
+            const Operation& operation = plan.operations.at(j);
+            if (operation.kind == OperationKind::Project && operation.row == loop.row) {
+                filled.insert(operation.slot);
+            }
+            
+            std::vector<Operand> reads = operation.keyValues;
+            reads.insert(reads.end(), operation.values.begin(), operation.values.end());
+            reads.push_back(operation.value);
+            for (const auto& operand : reads) {
+                if (operand.kind == Operand::Kind::Slot && filled.find(operand.index) != filled.end()) {
+                    isRead = true;
+                }
+            }
+        }
+        
+        loop.stopsAtFirstMatch = !isRead;
+    }
+}
+
+/// Plans the body of a rule, starting with the predicate at @c first and then, at each step, the first predicate which shares
+/// a variable with those before it.
+///
+/// A @c nullptr source skips its predicate.
+Plan planForBody(const std::vector<const Relation*>& sources,
+                 const std::vector<PredicateShape>& shapes,
+                 const std::map<std::string, size_t>& slotIndexes,
+                 size_t first,
+                 bool firstReadsDelta,
+                 const std::vector<Operand>& headValues) {
+    Plan plan = Plan();
+    plan.slotCount = slotIndexes.size();
+    
+    std::vector<bool> isBound = std::vector<bool>(plan.slotCount, false);
+    std::vector<bool> isPlanned = std::vector<bool>(sources.size(), false);
+    for (size_t i = 0; i < sources.size(); i += 1) {
+        isPlanned.at(i) = sources.at(i) == nullptr;
+    }
+    
+    size_t next = first;
+    while (next < sources.size()) {
+        isPlanned.at(next) = true;
+        const Relation* relation = (next == first && firstReadsDelta) ? nullptr : sources.at(next);
+        appendPredicateToPlan(plan, relation, shapes.at(next), slotIndexes, isBound);
+        
+        // Prefer a predicate we can look up by what we know, so we don't loop over the whole of its relation.
+        size_t joinable = sources.size();
+        size_t unplanned = sources.size();
+        for (size_t i = 0; i < sources.size() && joinable == sources.size(); i += 1) {
+            if (isPlanned.at(i)) {
+                continue;
+            }
+            unplanned = std::min(unplanned, i);
+            for (const auto& variable : shapes.at(i).variables) {
+                if (isBound.at(slotIndexes.at(variable.first))) {
+                    joinable = i;
+                }
+            }
+        }
+        next = (joinable < sources.size()) ? joinable : unplanned;
+    }
+    
+    Operation insert = Operation();
+    insert.kind = OperationKind::Insert;
+    insert.values = headValues;
+    plan.operations.push_back(insert);
+    
+    markExistenceChecks(plan);
+    
+    return plan;
+}
+
+// MARK: - Rules
+
+CompiledRule::CompiledRule(Rule* rule, Database* database) {
+    this->rule = rule;
+    this->unsupportedReason = "";
+    this->derivesNothing = false;
+    this->derivedScheme = Tuple();
+    
+    Predicate* head = rule->getHeadPredicate();
+    this->headRelation = database->relationWithName(head->getIdentifier());
+    if (headRelation == nullptr) {
+        unsupportedReason = "no relation named " + head->getIdentifier();
+        return;
+    }
+    
+    // Resolve each body predicate's relation. Predicates naming no relation are skipped, as when joining.
+    std::vector<Predicate*> body = rule->getPredicates();
+    std::vector<const Relation*> sources = std::vector<const Relation*>();
+    std::vector<PredicateShape> shapes = std::vector<PredicateShape>();
+    for (auto predicate : body) {
+        const Relation* relation = database->relationWithName(predicate->getIdentifier());
+        if (relation != nullptr) {
+            std::string reason = unsupportedRelationReason(predicate, relation);
+            if (!reason.empty()) {
+                unsupportedReason = reason;
+                return;
+            }
+        }
+        
+        sources.push_back(relation);
+        shapes.push_back(shapeOfPredicate(predicate));
+    }
+    
+    // Number the variables in the order they first appear.
+    std::map<std::string, size_t> slotIndexes = std::map<std::string, size_t>();
+    for (size_t i = 0; i < body.size(); i += 1) {
+        if (sources.at(i) == nullptr) {
+            continue;
+        }
+        for (const auto& variable : shapes.at(i).variables) {
+            if (slotIndexes.find(variable.first) == slotIndexes.end()) {
+                slotIndexes.insert(std::make_pair(variable.first, slotNames.size()));
+                slotNames.push_back(variable.first);
+            }
+        }
+    }
+    
+    // The head must name each of its relation's columns with a distinct variable from the body.
+    std::vector<std::string> headItems = head->getItems();
+    std::vector<Operand> headValues = std::vector<Operand>();
+    if (headItems.size() != headRelation->getColumnCount()) {
+        unsupportedReason = head->toString() + " doesn't match the columns of " + headRelation->getName();
+        return;
+    }
+    for (size_t i = 0; i < headItems.size(); i += 1) {
+        auto slot = slotIndexes.find(headItems.at(i));
+        if (slot == slotIndexes.end()) {
+            unsupportedReason = head->toString() + " names " + headItems.at(i) + ", which the body doesn't bind";
+            return;
+        }
+        if (std::find(headItems.begin(), headItems.begin() + i, headItems.at(i)) != headItems.begin() + i) {
+            unsupportedReason = head->toString() + " repeats " + headItems.at(i);
+            return;
+        }
+        headValues.push_back(Operand::slot(slot->second));
+    }
+    std::set<std::string> headColumns = std::set<std::string>(headRelation->getScheme().begin(),
+                                                              headRelation->getScheme().end());
+    if (headColumns.size() != headRelation->getColumnCount()) {
+        unsupportedReason = headRelation->getName() + " repeats a column name";
+        return;
+    }
+    
+    // A predicate which binds no variables narrows to no columns, which leaves no rows to join.
+    bool hasSource = false;
+    for (size_t i = 0; i < body.size(); i += 1) {
+        if (sources.at(i) != nullptr) {
+            hasSource = true;
+            derivesNothing = derivesNothing || shapes.at(i).variables.empty();
+        }
+    }
+    derivesNothing = derivesNothing || !hasSource;
+    
+    // Renaming to the head's columns goes one at a time, skipping any whose new name is still taken. If that leaves the
+    // columns misnamed, what's derived won't be union-compatible with the head relation, whatever its rows.
+    Relation renamed = Relation(head->getIdentifier(), Tuple(headItems));
+    for (size_t i = 0; i < headItems.size(); i += 1) {
+        renamed.rename(renamed.getScheme().at(i), headRelation->getScheme().at(i));
+    }
+    derivedScheme = renamed.getScheme();
+    derivesNothing = derivesNothing || derivedScheme != headRelation->getScheme();
+    
+    if (derivesNothing) {
+        return;
+    }
+    
+    size_t first = 0;
+    while (sources.at(first) == nullptr) {
+        first += 1;
+    }
+    fullPlan = planForBody(sources, shapes, slotIndexes, first, false, headValues);
+    
+    for (size_t i = 0; i < body.size(); i += 1) {
+        hasDeltaPlan.push_back(sources.at(i) != nullptr);
+        deltaPlans.push_back(hasDeltaPlan.back() ? planForBody(sources, shapes, slotIndexes, i, true, headValues) : Plan());
+    }
+}
+
+Rule* CompiledRule::getRule() const {
+    return rule;
+}
+
+bool CompiledRule::isCompiled() const {
+    return unsupportedReason.empty();
+}
+
+std::string CompiledRule::getUnsupportedReason() const {
+    return unsupportedReason;
+}
+
+bool CompiledRule::alwaysDerivesNothing() const {
+    return derivesNothing;
+}
+
+bool CompiledRule::isUnionCompatible() const {
+    return isCompiled() && derivedScheme == headRelation->getScheme();
+}
+
+const std::vector<std::string>& CompiledRule::getSlotNames() const {
+    return slotNames;
+}
+
+const Plan& CompiledRule::getPlan() const {
+    return fullPlan;
+}
+
+const Plan* CompiledRule::getDeltaPlan(size_t bodyIndex) const {
+    if (derivesNothing || bodyIndex >= hasDeltaPlan.size() || !hasDeltaPlan.at(bodyIndex)) {
+        return nullptr;
+    }
+    return &deltaPlans.at(bodyIndex);
+}
+
+Relation CompiledRule::derive() const {
+    Relation result = Relation(headRelation->getName(), derivedScheme);
+    if (derivesNothing) {
+        return result;
+    }
+    
+    for (auto& row : fullPlan.run()) {
+        result.addTuple(std::move(row));
+    }
+    
+    return result;
+}
+
+Relation CompiledRule::derive(size_t bodyIndex, const Relation& delta, const MaintainedIndexes* maintained) const {
+    Relation result = Relation(headRelation->getName(), derivedScheme);
+    if (derivesNothing || bodyIndex >= hasDeltaPlan.size() || !hasDeltaPlan.at(bodyIndex)) {
+        return result;
+    }
+    
+    for (auto& row : deltaPlans.at(bodyIndex).run(&delta, nullptr, maintained)) {
+        result.addTuple(std::move(row));
+    }
+    
+    return result;
+}
+
+Relation CompiledRule::derive(const std::map<std::string, Relation>& deltas, const MaintainedIndexes* maintained) const {
+    Relation result = Relation(headRelation->getName(), derivedScheme);
+    
+    std::vector<Predicate*> body = rule->getPredicates();
+    for (size_t i = 0; i < body.size(); i += 1) {
+        auto delta = deltas.find(body.at(i)->getIdentifier());
+        if (delta == deltas.end() || delta->second.getContents().empty()) {
+            continue;
+        }
+        result.insertAll(derive(i, delta->second, maintained));
+    }
+    
+    return result;
+}
+
+std::string CompiledRule::toString() const {
+    std::ostringstream result = std::ostringstream();
+    result << rule->toString() << std::endl;
+    
+    if (!isCompiled()) {
+        result << "  not compiled: " << unsupportedReason << std::endl;
+        return result.str();
+    }
+    if (derivesNothing) {
+        result << "  derives nothing" << std::endl;
+        return result.str();
+    }
+    
+    result << "  slots:";
+    for (size_t i = 0; i < slotNames.size(); i += 1) {
+        result << " " << stringForOperand(Operand::slot(i), 0, slotNames);
+        result << ((i + 1 < slotNames.size()) ? "," : "");
+    }
+    result << std::endl;
+    
+    result << "  plan:" << std::endl;
+    result << fullPlan.toString(slotNames, 4);
+    
+    std::vector<Predicate*> body = rule->getPredicates();
+    for (size_t i = 0; i < deltaPlans.size(); i += 1) {
+        if (!hasDeltaPlan.at(i)) {
+            continue;
+        }
+        result << "  plan for new rows of " << body.at(i)->toString() << ":" << std::endl;
+        result << deltaPlans.at(i).toString(slotNames, 4);
+    }
+    
+    return result.str();
+}
+
+// MARK: - Queries
+
+CompiledQuery::CompiledQuery(Predicate* query, Database* database) {
+    this->query = query;
+    this->unsupportedReason = "";
+    
+    this->relation = database->relationWithName(query->getIdentifier());
+    if (relation == nullptr) {
+        unsupportedReason = "no relation named " + query->getIdentifier();
+        return;
+    }
+    
+    unsupportedReason = unsupportedRelationReason(query, relation);
+    if (!unsupportedReason.empty()) {
+        return;
+    }
+    
+    PredicateShape shape = shapeOfPredicate(query);
+    for (const auto& constant : shape.constants) {
+        constantColumns.push_back(constant.first);
+        constantValues.push_back(constant.second);
+    }
+    
+    std::map<std::string, size_t> slotIndexes = std::map<std::string, size_t>();
+    std::vector<Operand> values = std::vector<Operand>();
+    for (const auto& variable : shape.variables) {
+        slotIndexes.insert(std::make_pair(variable.first, variables.size()));
+        values.push_back(Operand::slot(variables.size()));
+        variables.push_back(variable.first);
+    }
+    
+    plan.slotCount = variables.size();
+    std::vector<bool> isBound = std::vector<bool>(plan.slotCount, false);
+    appendPredicateToPlan(plan, relation, shape, slotIndexes, isBound);
+    
+    // Every matching row counts toward the answer, so the loop only stops early if at most one row can: when every column
+    // is given, leaving no variables to list.
+    plan.operations.front().stopsAtFirstMatch = variables.empty();
+    
+    Operation insert = Operation();
+    insert.kind = OperationKind::Insert;
+    insert.values = values;
+    plan.operations.push_back(insert);
+}
+
+Predicate* CompiledQuery::getQuery() const {
+    return query;
+}
+
+const Relation* CompiledQuery::getRelation() const {
+    return relation;
+}
+
+bool CompiledQuery::isCompiled() const {
+    return unsupportedReason.empty();
+}
+
+std::string CompiledQuery::getUnsupportedReason() const {
+    return unsupportedReason;
+}
+
+const Tuple& CompiledQuery::getVariables() const {
+    return variables;
+}
+
+const std::vector<size_t>& CompiledQuery::getConstantColumns() const {
+    return constantColumns;
+}
+
+const Tuple& CompiledQuery::getConstantValues() const {
+    return constantValues;
+}
+
+bool CompiledQuery::isNarrowedByConstants() const {
+    return isCompiled() && plan.operations.front().keyColumns.size() == constantColumns.size();
+}
+
+const Plan& CompiledQuery::getPlan() const {
+    return plan;
+}
+
+std::string CompiledQuery::evaluate(const Relation* source) const {
+    StringSink result = StringSink();
+    evaluate(result, source);
+    return result.takeContents();
+}
+
+void CompiledQuery::evaluate(OutputSink& output, const Relation* source) const {
+    size_t matchCount = 0;
+    Relation found = bindings(matchCount, source);
+    if (matchCount == 0) {
+        output << "No\n";
+    } else {
+        output << "Yes(" << std::to_string(matchCount) << ")\n";
+    }
+    
+    for (const Tuple& t : found.getContents()) {
+        output.writeRow(found, t);
+    }
+}
+
+Relation CompiledQuery::bindings(size_t& matchCount, const Relation* source) const {
+    // Read the given rows by running a copy of the plan which loops over them instead.
+    Plan sourcePlan = Plan();
+    if (source != nullptr) {
+        sourcePlan = plan;
+        sourcePlan.operations.front().relation = source;
+    }
+    
+    matchCount = 0;
+    std::vector<Tuple> rows = ((source != nullptr) ? sourcePlan : plan).run(nullptr, &matchCount);
+    
+    Relation found = Relation(relation->getName(), variables);
+    if (!variables.empty()) {
+        for (auto& row : rows) {
+            found.addTuple(std::move(row));
+        }
+    }
+    return found;
+}
+
+Relation CompiledQuery::matchingRows(const Relation* source) const {
+    Relation result = Relation(relation->getName(), relation->getScheme());
+    if (!isCompiled()) {
+        return result;
+    }
+    
+    // Run a copy of the plan which inserts each row it matches whole, in place of the query's variables.
+    Plan rowsPlan = plan;
+    if (source != nullptr) {
+        rowsPlan.operations.front().relation = source;
+    }
+    Operation& insert = rowsPlan.operations.back();
+    insert.values.clear();
+    for (size_t col = 0; col < relation->getColumnCount(); col += 1) {
+        insert.values.push_back(Operand::column(col));
+    }
+    
+    for (auto& row : rowsPlan.run()) {
+        result.addTuple(std::move(row));
+    }
+    return result;
+}
+
+std::string CompiledQuery::toString() const {
+    std::ostringstream result = std::ostringstream();
+    result << query->toString() << std::endl;
+    
+    if (!isCompiled()) {
+        result << "  not compiled: " << unsupportedReason << std::endl;
+        return result.str();
+    }
+    
+    result << "  plan:" << std::endl;
+    result << plan.toString(variables, 4);
+    
+    return result.str();
+}
+
+// MARK: - Program
+
+CompiledProgram::CompiledProgram(DatalogProgram* program, Database* database) :
+    CompiledProgram(program->getRules(), program->getQueries(), database) {}
+
+CompiledProgram::CompiledProgram(const std::vector<Rule*>& rules,
+                                 const std::vector<Predicate*>& queries,
+                                 Database* database) {
+    for (auto rule : rules) {
+        ruleIndexes.insert(std::make_pair(rule, this->rules.size()));
+        this->rules.push_back(CompiledRule(rule, database));
+    }
+    for (auto query : queries) {
+        queryIndexes.insert(std::make_pair(query, this->queries.size()));
+        this->queries.push_back(CompiledQuery(query, database));
+    }
+}
+
+const CompiledRule* CompiledProgram::compiledRule(Rule* rule) const {
+    auto index = ruleIndexes.find(rule);
+    return (index == ruleIndexes.end()) ? nullptr : &rules.at(index->second);
+}
+
+const CompiledQuery* CompiledProgram::compiledQuery(Predicate* query) const {
+    auto index = queryIndexes.find(query);
+    return (index == queryIndexes.end()) ? nullptr : &queries.at(index->second);
+}
+
+std::string CompiledProgram::toString() const {
+    std::ostringstream result = std::ostringstream();
+    
+    result << "Rules(" << rules.size() << "):" << std::endl;
+    for (const auto& rule : rules) {
+        result << rule.toString();
+    }
+    
+    result << "Queries(" << queries.size() << "):" << std::endl;
+    for (const auto& query : queries) {
+        result << query.toString();
+    }
+    
+    return result.str();
+}
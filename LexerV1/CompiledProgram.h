@@ -0,0 +1,291 @@
+//
+//  CompiledProgram.h
+//  LexerV1
+//
+//  Created by James Robinson on 12/18/19.
+//
+
+#ifndef CompiledProgram_h
+#define CompiledProgram_h
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include "Relation.h"
+#include "Database.h"
+#include "DatalogProgram.h"
+#include "OutputSink.h"
+
+// MARK: - Operations
+
+/// The kinds of operation in a compiled plan.
+enum class OperationKind {
+    /// Loops over every row of a relation, or only those whose leading columns hold the given constants, which lie together
+    /// among its sorted rows.
+    Scan,
+    /// Loops over the rows of a relation whose key columns hold the given values.
+    IndexLookup,
+    /// Goes on only if a column of the current row holds the given value.
+    Filter,
+    /// Copies a column of the current row into a variable slot.
+    Project,
+    /// Adds a row built from the given values to the output.
+    Insert,
+};
+
+/// Where an operation finds a value.
+struct Operand {
+    enum class Kind {
+        /// A value written in the program.
+        Constant,
+        /// A variable bound by an earlier operation.
+        Slot,
+        /// Another column of the current row.
+        Column,
+    };
+    
+    Kind kind = Kind::Constant;
+    std::string constant;
+    /// The slot or column which holds the value.
+    size_t index = 0;
+    
+    static Operand constantValue(const std::string& value);
+    static Operand slot(size_t slot);
+    static Operand column(size_t column);
+};
+
+/// One operation in a compiled plan. Every operation runs once for each row produced by the loops before it.
+struct Operation {
+    OperationKind kind = OperationKind::Scan;
+    
+    /// The relation a loop reads, or @c nullptr if it reads the delta given when the plan runs.
+    const Relation* relation = nullptr;
+    /// The row register a loop fills, or which a filter or projection reads.
+    size_t row = 0;
+    
+    /// The columns a lookup matches, or the leading columns a scan is limited to, and the values they must hold.
+    std::vector<size_t> keyColumns = {};
+    std::vector<Operand> keyValues = {};
+    
+    /// Set if nothing after a loop reads what it binds, so that one row reaching the end of the plan is enough.
+    bool stopsAtFirstMatch = false;
+    
+    /// The column a filter or projection reads.
+    size_t column = 0;
+    /// The value a filter expects.
+    Operand value = Operand();
+    /// The slot a projection fills.
+    size_t slot = 0;
+    
+    /// The values an insert writes.
+    std::vector<Operand> values = {};
+};
+
+/// A relation's rows, keyed by the hash of a lookup's key columns.
+typedef std::unordered_multimap<size_t, const Tuple*> LookupIndex;
+
+struct Plan;
+
+/// Lookup indexes on relations which are kept up to date as rows are added and removed, so that plans reading those relations
+/// needn't build their own each time they run.
+///
+/// Holds pointers to the relations and their rows, so every change to an indexed relation must be reported to it.
+class MaintainedIndexes {
+private:
+    std::map<std::pair<const Relation*, std::vector<size_t>>, LookupIndex> indexes;
+    
+public:
+    /// Builds an index for each lookup in @c plan which reads a relation of its own, unless one is already kept.
+    void addIndexesFor(const Plan& plan);
+    
+    /// Returns the index on @c relation keyed by @c keyColumns, or @c nullptr if none is kept.
+    const LookupIndex* indexFor(const Relation* relation, const std::vector<size_t>& keyColumns) const;
+    
+    /// Adds @c row, which the relation has just added, to each index on @c relation.
+    void rowAdded(const Relation* relation, const Tuple* row);
+    
+    /// Removes @c row from each index on @c relation. Call this before the relation removes it.
+    void rowRemoving(const Relation* relation, const Tuple* row);
+};
+
+/// A nest of loops, filters and projections, ending in an insert.
+struct Plan {
+    std::vector<Operation> operations = {};
+    size_t rowCount = 0;
+    size_t slotCount = 0;
+    
+    /// Runs the plan, spreading the rows of its outermost loop across the shared thread pool.
+    ///
+    /// @param delta The relation read by loops which have no relation of their own.
+    /// @param matchCount If given, receives how many times the insert ran.
+    /// @param maintained Indexes to read in place of building them, where they have one.
+    /// @returns The rows inserted, sorted and without duplicates.
+    std::vector<Tuple> run(const Relation* delta = nullptr,
+                           size_t* matchCount = nullptr,
+                           const MaintainedIndexes* maintained = nullptr) const;
+    
+    /// Describes the plan's operations, one per line, each nested under the loop it runs in.
+    std::string toString(const std::vector<std::string>& slotNames, size_t indent) const;
+};
+
+// MARK: - Rules and Queries
+
+/// A rule lowered to plans which read resolved relations and bind its variables to numbered slots.
+///
+/// Holds pointers to relations in the database. The database keeps each relation at one address, even when
+/// @c Database::addRelation gives it new rows, so the pointers stay valid for the life of the database. Whether a
+/// @c MaintainedIndexes on a relation has gone stale follows from the relation's version, not its address.
+class CompiledRule {
+private:
+    Rule* rule;
+    Relation* headRelation;
+    
+    /// Why the rule could not be compiled, or empty if it was.
+    std::string unsupportedReason;
+    /// Set if the rule can never derive anything, such as when a body predicate binds no variables.
+    bool derivesNothing;
+    /// The columns of what the rule derives, which match the head relation's unless renaming them failed.
+    Tuple derivedScheme;
+    
+    std::vector<std::string> slotNames;
+    Plan fullPlan;
+    /// A plan for each body predicate, which reads that predicate from a delta first.
+    std::vector<Plan> deltaPlans;
+    std::vector<bool> hasDeltaPlan;
+    
+public:
+    CompiledRule(Rule* rule, Database* database);
+    
+    Rule* getRule() const;
+    
+    /// Returns @c true if the rule was compiled. Rules which were not must be evaluated some other way.
+    bool isCompiled() const;
+    
+    /// Returns why the rule could not be compiled, or an empty string if it was.
+    std::string getUnsupportedReason() const;
+    
+    /// Returns @c true if the rule can never derive anything.
+    bool alwaysDerivesNothing() const;
+    
+    /// Returns @c true if what the rule derives can be added to its head relation. If not, adding it empties the head
+    /// relation instead.
+    bool isUnionCompatible() const;
+    
+    const std::vector<std::string>& getSlotNames() const;
+    
+    /// Returns the plan which reads every body predicate from its relation.
+    const Plan& getPlan() const;
+    
+    /// Returns the plan which reads the body predicate at @c bodyIndex from a delta, or @c nullptr if there is none.
+    const Plan* getDeltaPlan(size_t bodyIndex) const;
+    
+    /// Derives what the rule yields from the relations as they stand, named and ordered like its head relation.
+    ///
+    /// If renaming the derived columns to the head relation's failed, the result keeps the names it was left with.
+    Relation derive() const;
+    
+    /// Derives what the rule yields when the body predicate at @c bodyIndex reads only @c delta.
+    Relation derive(size_t bodyIndex, const Relation& delta, const MaintainedIndexes* maintained = nullptr) const;
+    
+    /// Derives what the rule yields from the rows in @c deltas, which are keyed by relation name: each body predicate reading
+    /// one of these relations takes its turn reading only its delta.
+    Relation derive(const std::map<std::string, Relation>& deltas, const MaintainedIndexes* maintained = nullptr) const;
+    
+    std::string toString() const;
+};
+
+/// A query lowered to a plan which reads a resolved relation.
+///
+/// Holds a pointer to a relation in the database, which keeps the relation at one address, so the pointer stays valid for
+/// the life of the database.
+class CompiledQuery {
+private:
+    Predicate* query;
+    const Relation* relation;
+    
+    /// Why the query could not be compiled, or empty if it was.
+    std::string unsupportedReason;
+    
+    /// The query's variables, in the order they first appear.
+    Tuple variables;
+    /// The columns the query gives constants for, and those constants.
+    std::vector<size_t> constantColumns;
+    Tuple constantValues;
+    Plan plan;
+    
+public:
+    CompiledQuery(Predicate* query, Database* database);
+    
+    Predicate* getQuery() const;
+    
+    /// Returns the relation the query reads.
+    const Relation* getRelation() const;
+    
+    /// Returns @c true if the query was compiled. Queries which were not must be evaluated some other way.
+    bool isCompiled() const;
+    
+    /// Returns why the query could not be compiled, or an empty string if it was.
+    std::string getUnsupportedReason() const;
+    
+    /// Returns the query's variables, in the order they first appear.
+    const Tuple& getVariables() const;
+    
+    /// Returns the columns the query gives constants for, in order.
+    const std::vector<size_t>& getConstantColumns() const;
+    
+    /// Returns the constants the query gives, one for each of its constant columns.
+    const Tuple& getConstantValues() const;
+    
+    /// Returns @c true if the query's scan is narrowed to the rows holding every one of its constants, leaving none to
+    /// filter.
+    bool isNarrowedByConstants() const;
+    
+    const Plan& getPlan() const;
+    
+    /// Evaluates the query.
+    ///
+    /// @param source If given, the rows to read in place of the query's relation. They must include every row of it which
+    /// holds the query's constants.
+    /// @returns "Yes(n)" or "No", then a line for each distinct binding of its variables.
+    std::string evaluate(const Relation* source = nullptr) const;
+    
+    /// Evaluates the query as @c evaluate does, writing the answer to @c output as it goes.
+    void evaluate(OutputSink& output, const Relation* source = nullptr) const;
+    
+    /// Returns the distinct bindings of the query's variables, which @c evaluate lists, or no rows if it has none.
+    ///
+    /// @param matchCount Receives how many rows the query matched, which @c evaluate counts in its "Yes(n)".
+    Relation bindings(size_t& matchCount, const Relation* source = nullptr) const;
+    
+    /// Returns the rows of the query's relation, or of @c source, which the query matches, with every column.
+    Relation matchingRows(const Relation* source = nullptr) const;
+    
+    std::string toString() const;
+};
+
+// MARK: - Program
+
+/// The rules and queries of a program, compiled once against a database and reused for every evaluation.
+class CompiledProgram {
+private:
+    std::vector<CompiledRule> rules;
+    std::map<Rule*, size_t> ruleIndexes;
+    std::vector<CompiledQuery> queries;
+    std::map<Predicate*, size_t> queryIndexes;
+    
+public:
+    CompiledProgram(DatalogProgram* program, Database* database);
+    CompiledProgram(const std::vector<Rule*>& rules, const std::vector<Predicate*>& queries, Database* database);
+    
+    /// Returns the compiled form of @c rule, or @c nullptr if it is not part of the program.
+    const CompiledRule* compiledRule(Rule* rule) const;
+    
+    /// Returns the compiled form of @c query, or @c nullptr if it is not part of the program.
+    const CompiledQuery* compiledQuery(Predicate* query) const;
+    
+    /// Describes every compiled rule and query, for debugging.
+    std::string toString() const;
+};
+
+#endif /* CompiledProgram_h */
@@ -10,6 +10,7 @@
 
 Database::Database() {
     this->relations = {};
+    this->relationIndexes = {};
 }
 
 Database::~Database() {
@@ -18,39 +19,40 @@ Database::~Database() {
     }
     
     relations.clear();
+    relationIndexes.clear();
 }
 
-const std::vector<Relation*> Database::getRelations() {
+const std::vector<Relation*>& Database::getRelations() const {
     return this->relations;
 }
 
 bool Database::addRelation(Relation* relation) {
-    for (size_t i = 0; i < this->relations.size(); i += 1) {
-        Relation* extantRelation = this->relations.at(i);
-        
-        if (extantRelation->getName() == relation->getName()) {
-            // Relation with same name? If it's new, replace what we have.
-            if (*extantRelation != *relation) {
-                delete extantRelation;
-                this->relations.erase(this->relations.begin() + i);
-                break;
-            } else {
-                // Identical? Do nothing.
-                return false;
-            }
-        }
+    auto extant = relationIndexes.find(relation->getName());
+    if (extant == relationIndexes.end()) {
+        relationIndexes.insert(std::make_pair(relation->getName(), relations.size()));
+        relations.push_back(relation);
+        return true;
     }
     
-    this->relations.push_back(relation);
-    return true;
+    Relation* extantRelation = relations.at(extant->second);
+    if (extantRelation == relation) {
+        return false;
+    }
+    
+    // Relation with same name? If it's new, update what we have, so anything holding it sees the change.
+    bool isNew = *extantRelation != *relation;
+    if (isNew) {
+        *extantRelation = *relation;
+    }
+    delete relation;
+    return isNew;
 }
 
-Relation* Database::relationWithName(std::string name) {
-    for (unsigned int i = 0; i < relations.size(); i += 1) {
-        if (relations.at(i)->getName() == name) {
-            return relations.at(i);
-        }
+Relation* Database::relationWithName(const std::string& name) const {
+    auto found = relationIndexes.find(name);
+    if (found == relationIndexes.end()) {
+        return nullptr;
     }
     
-    return nullptr;
+    return relations.at(found->second);
 }
@@ -11,22 +11,38 @@
 
 #include <string>
 #include <vector>
+#include <unordered_map>
 #include "Relation.h"
 #include "Tuple.h"
 
+/// The relations a program works on, each found by its name in constant time.
+///
+/// A relation keeps its place and its address once added, so a @c Relation* looked up once, as compiled rules and queries
+/// do, stays valid for as long as the database does.
 class Database {
 private:
+    /// In the order they were added.
     std::vector<Relation*> relations;
+    /// The index in @c relations of each relation, by name.
+    std::unordered_map<std::string, size_t> relationIndexes;
     
 public:
     Database();
     ~Database();
     
-    const std::vector<Relation*> getRelations();
-    /// Adds the given @c relation to the database.
-    /// @returns @c true if the relation was added.
+    /// Returns every relation, in the order they were added.
+    const std::vector<Relation*>& getRelations() const;
+    
+    /// Adds the given @c relation to the database, which takes ownership of it.
+    ///
+    /// If the database already holds a relation of the same name, that one takes the scheme and rows of @c relation in
+    /// place, keeping its address, and @c relation is deleted.
+    ///
+    /// @returns @c true if the relation was added, or changed the one of the same name.
     bool addRelation(Relation* relation);
-    Relation* relationWithName(std::string name);
+    
+    /// Returns the relation named @c name, or @c nullptr if there is none.
+    Relation* relationWithName(const std::string& name) const;
 };
 
 #endif /* Database_h */
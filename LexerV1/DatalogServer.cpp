@@ -0,0 +1,315 @@
+//
+//  DatalogServer.cpp
+//  LexerV1
+//
+//  Created by James Robinson on 12/29/19.
+//
+
+#include "DatalogServer.h"
+#include <sstream>
+#include <cstring>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Lexer.h"
+#include "EvaluatingDatabases.h"
+
+DatalogServer::DatalogServer(DatalogProgram* program, Database* database): evaluator(program, database) {
+    this->program = program;
+    this->database = database;
+    this->isShuttingDown = false;
+    this->commandCount = 0;
+}
+
+// MARK: - Commands
+
+/// Returns how @c token reads in an error message.
+std::string describedToken(const Token* token) {
+    return (token->getType() == EOF_T) ? "the end of the command" : "'" + token->getValue() + "'";
+}
+
+std::vector<Predicate*> DatalogServer::predicatesFromTokens(const std::vector<Token*>& tokens,
+                                                            size_t index,
+                                                            TokenType terminator,
+                                                            std::string& error) const {
+    std::vector<Predicate*> result = std::vector<Predicate*>();
+    
+    auto fail = [&](const std::string& reason) {
+        for (auto predicate : result) {
+            delete predicate;
+        }
+        result.clear();
+        error = reason;
+        return result;
+    };
+    
+    while (index < tokens.size() && tokens.at(index)->getType() != EOF_T) {
+        if (tokens.at(index)->getType() != ID) {
+            return fail("expected a relation name, not " + describedToken(tokens.at(index)));
+        }
+        Predicate* predicate = new Predicate((terminator == Q_MARK) ? QUERIES : FACTS, tokens.at(index)->getValue());
+        result.push_back(predicate);
+        index += 1;
+        
+        if (tokens.at(index)->getType() != LEFT_PAREN) {
+            return fail("expected '(' after " + predicate->getIdentifier() + ", not " + describedToken(tokens.at(index)));
+        }
+        index += 1;
+        
+        // Facts hold only strings, but queries may hold variables too.
+        while (true) {
+            TokenType type = tokens.at(index)->getType();
+            if (type != STRING && (type != ID || terminator != Q_MARK)) {
+                return fail("expected a value in " + predicate->getIdentifier() + ", not " + describedToken(tokens.at(index)));
+            }
+            predicate->addItem(tokens.at(index)->getValue());
+            index += 1;
+            
+            if (tokens.at(index)->getType() == COMMA) {
+                index += 1;
+            } else {
+                break;
+            }
+        }
+        
+        if (tokens.at(index)->getType() != RIGHT_PAREN) {
+            return fail("expected ')' to close " + predicate->getIdentifier() + ", not " + describedToken(tokens.at(index)));
+        }
+        index += 1;
+        
+        if (tokens.at(index)->getType() != terminator) {
+            return fail("expected '" + TERMINALS.at(terminator) + "' after " + predicate->getIdentifier() + "(...), not "
+                        + describedToken(tokens.at(index)));
+        }
+        index += 1;
+    }
+    
+    if (result.empty()) {
+        error = "nothing given";
+    }
+    return result;
+}
+
+std::string DatalogServer::changeFacts(const std::vector<Token*>& tokens, bool isAdding) {
+    std::string error = "";
+    std::vector<Predicate*> facts = predicatesFromTokens(tokens, 1, PERIOD, error);
+    if (facts.empty()) {
+        return "Error: " + error;
+    }
+    
+    // Rather than ignore facts which don't fit, as when loading a program, say so.
+    for (auto fact : facts) {
+        Relation* relation = database->relationWithName(fact->getIdentifier());
+        if (relation == nullptr) {
+            error = "no relation named " + fact->getIdentifier();
+        } else if (fact->getItems().size() != relation->getColumnCount()) {
+            error = relation->getName() + " has " + std::to_string(relation->getColumnCount()) + " columns, not "
+                + std::to_string(fact->getItems().size());
+        }
+    }
+    if (!error.empty()) {
+        for (auto fact : facts) {
+            delete fact;
+        }
+        return "Error: " + error;
+    }
+    
+    // Facts already present, or already absent, aren't counted.
+    size_t changedCount = 0;
+    if (isAdding) {
+        changedCount = evaluator.update(facts, std::vector<Predicate*>());
+    } else {
+        changedCount = evaluator.update(std::vector<Predicate*>(), facts);
+    }
+    
+    std::ostringstream result = std::ostringstream();
+    result << (isAdding ? "Added " : "Removed ") << changedCount << ((changedCount == 1) ? " fact" : " facts");
+    
+    for (auto fact : facts) {
+        delete fact;
+    }
+    return result.str();
+}
+
+std::string DatalogServer::answerQuery(const std::vector<Token*>& tokens) {
+    std::string error = "";
+    std::vector<Predicate*> queries = predicatesFromTokens(tokens, 0, Q_MARK, error);
+    if (queries.empty()) {
+        return "Error: " + error;
+    }
+    
+    // Answer them as evaluateQueries would, through the cache where they compile.
+    std::ostringstream result = std::ostringstream();
+    for (auto query : queries) {
+        // Frees the query once it's answered.
+        DatalogProgram asked = DatalogProgram();
+        asked.addQuery(query);
+        
+        CompiledQuery compiled = CompiledQuery(query, database);
+        if (compiled.isCompiled()) {
+            result << query->toString() << " " << cache.answer(compiled);
+        } else {
+            result << evaluateQueries(database, &asked, false) << std::endl;
+        }
+    }
+    return result.str();
+}
+
+std::string DatalogServer::stats() const {
+    std::ostringstream result = std::ostringstream();
+    
+    for (auto relation : database->getRelations()) {
+        size_t rowCount = relation->getContents().size();
+        result << relation->getName() << ": " << rowCount << ((rowCount == 1) ? " row" : " rows") << std::endl;
+    }
+    
+    result << program->getRules().size() << " rules, ";
+    if (evaluator.canMaintain()) {
+        result << "updated incrementally" << std::endl;
+    } else {
+        result << "evaluated from scratch on each change: " << evaluator.getUnsupportedReason() << std::endl;
+    }
+    result << "query cache: " << cache.getHitCount() << " hits (" << cache.getSubsumedHitCount()
+        << " from more general queries), " << cache.getMissCount() << " misses, " << cache.getEntryCount() << " entries"
+        << std::endl;
+    result << commandCount << " commands served";
+    
+    return result.str();
+}
+
+std::string DatalogServer::respond(const std::string& command, bool& isEndingSession) {
+    isEndingSession = false;
+    commandCount += 1;
+    
+    std::istringstream iSS = std::istringstream(command);
+    std::vector<Token*> tokens = collectedTokensFromFile(iSS);
+    
+    // Comments mean nothing here.
+    std::vector<Token*> meaningful = std::vector<Token*>();
+    for (auto token : tokens) {
+        if (token->getType() != COMMENT) {
+            meaningful.push_back(token);
+        }
+    }
+    
+    std::string response = "";
+    std::string word = (meaningful.front()->getType() == ID) ? meaningful.front()->getValue() : "";
+    bool isWordAlone = meaningful.size() == 2;
+    bool isWordCommand = !word.empty() && meaningful.at(1)->getType() != LEFT_PAREN;
+    
+    if (meaningful.front()->getType() == EOF_T) {
+        response = "";
+        
+    } else if (isWordCommand && (word == "add" || word == "remove")) {
+        response = changeFacts(meaningful, word == "add");
+        
+    } else if (isWordCommand && isWordAlone && word == "queries") {
+        response = evaluateQueries(database, program);
+        
+    } else if (isWordCommand && isWordAlone && word == "evaluate") {
+        response = evaluator.recompute();
+        
+    } else if (isWordCommand && isWordAlone && word == "stats") {
+        response = stats();
+        
+    } else if (isWordCommand && isWordAlone && (word == "quit" || word == "shutdown")) {
+        isShuttingDown = word == "shutdown";
+        isEndingSession = true;
+        response = "Goodbye";
+        
+    } else if (isWordCommand) {
+        response = "Error: unknown command '" + word + "'";
+        
+    } else {
+        response = answerQuery(meaningful);
+    }
+    
+    releaseTokens(tokens);
+    
+    // One empty line ends the response, so it mustn't hold any.
+    while (!response.empty() && iswspace(response.back())) {
+        response.pop_back();
+    }
+    return response;
+}
+
+// MARK: - Serving
+
+/// Returns @c response as it's sent: each of its lines, then an empty one.
+std::string framedResponse(const std::string& response) {
+    return response.empty() ? "\n" : response + "\n\n";
+}
+
+void DatalogServer::serve(std::istream& input, std::ostream& output) {
+    std::string line = "";
+    bool isEndingSession = false;
+    
+    while (!isEndingSession && std::getline(input, line)) {
+        output << framedResponse(respond(line, isEndingSession)) << std::flush;
+    }
+}
+
+bool DatalogServer::serve(const std::string& socketPath) {
+    sockaddr_un address = sockaddr_un();
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+    
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        return false;
+    }
+    
+    unlink(socketPath.c_str());
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(listener, 8) < 0) {
+        close(listener);
+        return false;
+    }
+    
+    // A client hanging up mid-response shouldn't take the server with it.
+    signal(SIGPIPE, SIG_IGN);
+    
+    while (!isShuttingDown) {
+        int connection = accept(listener, nullptr, nullptr);
+        if (connection < 0) {
+            continue;
+        }
+        
+        std::string buffer = "";
+        char chunk[4096];
+        bool isEndingSession = false;
+        
+        while (!isEndingSession) {
+            ssize_t readCount = read(connection, chunk, sizeof(chunk));
+            if (readCount <= 0) {
+                break;
+            }
+            buffer.append(chunk, static_cast<size_t>(readCount));
+            
+            size_t newline = buffer.find('\n');
+            while (!isEndingSession && newline != std::string::npos) {
+                std::string response = framedResponse(respond(buffer.substr(0, newline), isEndingSession));
+                buffer.erase(0, newline + 1);
+                newline = buffer.find('\n');
+                
+                for (size_t sent = 0; sent < response.size(); ) {
+                    ssize_t sentCount = write(connection, response.data() + sent, response.size() - sent);
+                    if (sentCount <= 0) {
+                        isEndingSession = true;
+                        break;
+                    }
+                    sent += static_cast<size_t>(sentCount);
+                }
+            }
+        }
+        
+        close(connection);
+    }
+    
+    close(listener);
+    unlink(socketPath.c_str());
+    return true;
+}
@@ -0,0 +1,72 @@
+//
+//  DatalogServer.h
+//  LexerV1
+//
+//  Created by James Robinson on 12/29/19.
+//
+
+#ifndef DatalogServer_h
+#define DatalogServer_h
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Token.h"
+#include "Database.h"
+#include "DatalogProgram.h"
+#include "IncrementalEvaluator.h"
+#include "QueryCache.h"
+
+/// Keeps a program's database in memory, answering commands one line at a time.
+///
+/// Each command gets a response of one or more lines, followed by an empty line:
+///
+/// - @c add and @c remove, followed by one or more facts, change the facts and update what the rules derive.
+/// - A query, such as @c r('a',X)?, is answered as @c evaluateQueries would answer it.
+/// - @c queries answers the program's own queries.
+/// - @c evaluate evaluates the rules again from scratch, and responds with their trace.
+/// - @c stats lists the relations and how many rows each holds, and how often the query cache answered.
+/// - @c quit ends the session, and @c shutdown also stops the server.
+class DatalogServer {
+private:
+    DatalogProgram* program;
+    Database* database;
+    IncrementalEvaluator evaluator;
+    /// Answers queries asked again, or more specifically, until the relations they read change.
+    QueryCache cache;
+    
+    bool isShuttingDown;
+    size_t commandCount;
+    
+    /// Reads the predicates in @c tokens from @c index onward, each ending in a token of @c terminator.
+    ///
+    /// @returns The predicates, or an empty list if the tokens don't form them, in which case @c error says why.
+    std::vector<Predicate*> predicatesFromTokens(const std::vector<Token*>& tokens,
+                                                 size_t index,
+                                                 TokenType terminator,
+                                                 std::string& error) const;
+    
+    std::string changeFacts(const std::vector<Token*>& tokens, bool isAdding);
+    std::string answerQuery(const std::vector<Token*>& tokens);
+    std::string stats() const;
+    
+public:
+    /// @param database The database of @c program, already holding what evaluating its rules derives.
+    DatalogServer(DatalogProgram* program, Database* database);
+    
+    /// Runs one command.
+    ///
+    /// @param isEndingSession Set if the command ends the session.
+    /// @returns The command's response, without the empty line which ends it.
+    std::string respond(const std::string& command, bool& isEndingSession);
+    
+    /// Answers each line of @c input on @c output, until the input ends or a command ends the session.
+    void serve(std::istream& input, std::ostream& output);
+    
+    /// Listens on a Unix domain socket at @c socketPath, serving each connection in turn until one shuts the server down.
+    ///
+    /// @returns @c false if the socket couldn't be opened.
+    bool serve(const std::string& socketPath);
+};
+
+#endif /* DatalogServer_h */
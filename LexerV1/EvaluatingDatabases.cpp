@@ -7,6 +7,9 @@
 //
 
 #include "EvaluatingDatabases.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <mutex>
 
 int indexOfValueInVector(std::string query, const std::vector<std::string> &domain) {
     for (unsigned int idx = 0; idx < domain.size(); idx += 1) {
@@ -52,7 +55,8 @@ void evaluateFacts(Database *database, DatalogProgram *program) {
 std::string evaluateQueryItem(Relation &result,
                               Database *database,
                               Predicate *query,
-                              bool outputSuccess) {
+                              bool outputSuccess,
+                              size_t *matchCount) {
     // Evaluate each item in query
     std::vector<size_t> matchColumns = {};
     std::vector< std::pair<size_t, std::string> > matchValues = {};
@@ -94,6 +98,9 @@ std::string evaluateQueryItem(Relation &result,
     if (!matchValues.empty()) {
         result.select(matchValues);
     }
+    if (matchCount != nullptr) {
+        *matchCount = result.getContents().size();
+    }
     
     std::ostringstream str = std::ostringstream();
     if (outputSuccess && result.getContents().empty()) {
@@ -116,40 +123,229 @@ std::string evaluateQueryItem(Relation &result,
     return str.str();
 }
 
-std::string evaluateQueries(Database *database, DatalogProgram *program, bool printingHeader) {
-    std::ostringstream str = std::ostringstream();
-    if (printingHeader) {
-        str << "Query Evaluation" << std::endl;
+/// Gathers the rows each of @c queries must read when it filters its relation by constants a narrowed scan can't find for
+/// it. Queries filtering the same relation by the same columns share a single pass over it, which routes each row to those
+/// whose constants it holds.
+///
+/// @param sources Filled with the rows each query should read, or @c nullptr where it should read its relation as usual.
+/// @returns The gathered rows, which @c sources points into.
+static vector<map<Tuple, Relation>> batchQueries(const vector<const CompiledQuery*>& queries,
+                                                 vector<const Relation*>& sources) {
+    sources = vector<const Relation*>(queries.size(), nullptr);
+    
+    // Each batch is keyed by the relation its queries read and the columns they filter.
+    map<pair<const Relation*, vector<size_t>>, vector<size_t>> batches = {};
+    for (size_t i = 0; i < queries.size(); i += 1) {
+        const CompiledQuery* query = queries.at(i);
+        if (query != nullptr && query->isCompiled() && !query->isNarrowedByConstants()) {
+            batches[std::make_pair(query->getRelation(), query->getConstantColumns())].push_back(i);
+        }
     }
-    for (unsigned int i = 0; i < program->getQueries().size(); i += 1) {
-        Predicate* query = program->getQueries().at(i);
-        
-        str << query->toString() << " ";
+    
+    // A query alone is answered as quickly by its own scan.
+    vector<vector<size_t>> sharedBatches = vector<vector<size_t>>();
+    for (const auto& batch : batches) {
+        if (batch.second.size() > 1) {
+            sharedBatches.push_back(batch.second);
+        }
+    }
+    
+    vector<map<Tuple, Relation>> buckets = vector<map<Tuple, Relation>>(sharedBatches.size());
+    ThreadPool::shared().parallelFor(sharedBatches.size(), [&](size_t b) {
+        const CompiledQuery* first = queries.at(sharedBatches.at(b).front());
+        const Relation* relation = first->getRelation();
+        const vector<size_t>& columns = first->getConstantColumns();
         
-        Relation* relation = database->relationWithName(query->getIdentifier());
-        if (relation == nullptr) {
-            str << "No" << std::endl;
-            continue;
+        map<Tuple, Relation>& bucket = buckets.at(b);
+        for (auto i : sharedBatches.at(b)) {
+            bucket.insert(std::make_pair(queries.at(i)->getConstantValues(),
+                                         Relation(relation->getName(), relation->getScheme())));
         }
-        Relation found = *relation;
-        str << evaluateQueryItem(found, database, query);
         
-        // If there are variables in the query, output the tuples from the resulting relation.
-        for (Tuple t : found.getContents()) {
-            str << "  " << found.stringForTuple(t) << std::endl;
+        Tuple key = Tuple(vector<string>(columns.size()));
+        for (const Tuple& row : relation->getContents()) {
+            for (size_t k = 0; k < columns.size(); k += 1) {
+                key[k] = row[columns[k]];
+            }
+            auto found = bucket.find(key);
+            if (found != bucket.end()) {
+                found->second.addTuple(row);
+            }
+        }
+    });
+    
+    for (size_t b = 0; b < sharedBatches.size(); b += 1) {
+        for (auto i : sharedBatches.at(b)) {
+            sources.at(i) = &buckets.at(b).at(queries.at(i)->getConstantValues());
+        }
+    }
+    
+    return buckets;
+}
+
+/// Returns the distinct bindings of @c query's variables, which @c answerForQuery lists.
+///
+/// Only reads the database, so many queries may be answered at once.
+///
+/// @param source If given, the rows a compiled query reads in place of its relation.
+/// @param matchCount Receives how many rows the query matched.
+static Relation bindingsForQuery(Database *database,
+                                 Predicate *query,
+                                 const CompiledQuery *compiledQuery,
+                                 const Relation *source,
+                                 size_t &matchCount) {
+    if (compiledQuery != nullptr && compiledQuery->isCompiled()) {
+        return compiledQuery->bindings(matchCount, source);
+    }
+    
+    matchCount = 0;
+    Relation* relation = database->relationWithName(query->getIdentifier());
+    if (relation == nullptr) {
+        return Relation(query->getIdentifier());
+    }
+    
+    // Start from only the rows holding the query's constants, rather than a copy of the whole relation.
+    Relation found = Relation(relation->getName(), relation->getScheme());
+    std::vector<std::string> items = query->getItems();
+    for (const Tuple& row : relation->getContents()) {
+        bool isMatch = true;
+        for (size_t col = 0; col < items.size() && col < row.size() && isMatch; col += 1) {
+            isMatch = items.at(col).at(0) != '\'' || row.at(col) == items.at(col);
+        }
+        if (isMatch) {
+            found.addTuple(row);
+        }
+    }
+    evaluateQueryItem(found, database, query, false, &matchCount);
+    
+    return found;
+}
+
+/// Writes the line answering @c query, then a line for each distinct binding of its variables.
+///
+/// Only reads the database, so many queries may be answered at once.
+///
+/// @param source If given, the rows a compiled query reads in place of its relation.
+static void answerForQuery(Database *database,
+                           Predicate *query,
+                           const CompiledQuery *compiledQuery,
+                           const Relation *source,
+                           OutputSink &output) {
+    output << query->toString() << " ";
+    
+    if (compiledQuery != nullptr && compiledQuery->isCompiled()) {
+        compiledQuery->evaluate(output, source);
+        return;
+    }
+    
+    size_t matchCount = 0;
+    Relation found = bindingsForQuery(database, query, compiledQuery, source, matchCount);
+    if (matchCount == 0) {
+        output << "No\n";
+    } else {
+        output << "Yes(" << std::to_string(matchCount) << ")\n";
+    }
+    
+    // If there are variables in the query, output the tuples from the resulting relation.
+    for (const Tuple& t : found.getContents()) {
+        output.writeRow(found, t);
+    }
+}
+
+void evaluateQueries(Database *database,
+                     DatalogProgram *program,
+                     OutputSink &output,
+                     bool printingHeader,
+                     const CompiledProgram *compiled) {
+    // Whitespace is held back until something follows it, so none ends the answers.
+    TrimmingSink trimmed = TrimmingSink(output);
+    
+    // Compile the queries here if they weren't already.
+    CompiledProgram localProgram = CompiledProgram(vector<Rule*>(),
+                                                   (compiled == nullptr) ? program->getQueries() : vector<Predicate*>(),
+                                                   database);
+    if (compiled == nullptr) {
+        compiled = &localProgram;
+    }
+    
+    if (printingHeader) {
+        trimmed << "Query Evaluation\n";
+    }
+    
+    std::vector<Predicate*> queries = program->getQueries();
+    std::vector<const CompiledQuery*> compiledQueries = std::vector<const CompiledQuery*>();
+    for (auto query : queries) {
+        compiledQueries.push_back(compiled->compiledQuery(query));
+    }
+    std::vector<const Relation*> sources = std::vector<const Relation*>();
+    std::vector<map<Tuple, Relation>> batchedRows = batchQueries(compiledQueries, sources);
+    
+    if (ThreadPool::shared().getThreadCount() < 2) {
+        for (size_t i = 0; i < queries.size(); i += 1) {
+            answerForQuery(database, queries.at(i), compiledQueries.at(i), sources.at(i), trimmed);
         }
+        return;
     }
     
-    std::string output = str.str();
-    for (size_t i = output.size() - 1; i >= 0; i -= 1) {
-        if (iswspace(output.at(i))) {
-            output.pop_back();
-        } else { // Only the trailing spaces
-            break;
+    // The rules are done, so the queries only read the database. Answer a window of them at once, then write those answers
+    // in order before starting the next, so that only one window's answers are held at a time.
+    size_t windowSize = ThreadPool::shared().getThreadCount() * 4;
+    for (size_t start = 0; start < queries.size(); start += windowSize) {
+        size_t count = std::min(windowSize, queries.size() - start);
+        std::vector<StringSink> answers = std::vector<StringSink>(count);
+        ThreadPool::shared().parallelFor(count, [&](size_t i) {
+            size_t index = start + i;
+            answerForQuery(database, queries.at(index), compiledQueries.at(index), sources.at(index), answers.at(i));
+        });
+        for (const auto& answer : answers) {
+            trimmed.write(answer.getContents());
         }
     }
+}
+
+void forEachQueryAnswer(Database *database,
+                        DatalogProgram *program,
+                        const std::function<void(Predicate*, size_t, const Relation&)>& visit,
+                        const CompiledProgram *compiled) {
+    CompiledProgram localProgram = CompiledProgram(vector<Rule*>(),
+                                                   (compiled == nullptr) ? program->getQueries() : vector<Predicate*>(),
+                                                   database);
+    if (compiled == nullptr) {
+        compiled = &localProgram;
+    }
+    
+    std::vector<Predicate*> queries = program->getQueries();
+    std::vector<const CompiledQuery*> compiledQueries = std::vector<const CompiledQuery*>();
+    for (auto query : queries) {
+        compiledQueries.push_back(compiled->compiledQuery(query));
+    }
+    std::vector<const Relation*> sources = std::vector<const Relation*>();
+    std::vector<map<Tuple, Relation>> batchedRows = batchQueries(compiledQueries, sources);
     
-    return output;
+    // As evaluateQueries does, answer a window of queries at once, then hand those answers on in order.
+    size_t windowSize = (ThreadPool::shared().getThreadCount() < 2) ? 1 : ThreadPool::shared().getThreadCount() * 4;
+    for (size_t start = 0; start < queries.size(); start += windowSize) {
+        size_t count = std::min(windowSize, queries.size() - start);
+        std::vector<Relation> answers = std::vector<Relation>(count, Relation(""));
+        std::vector<size_t> matchCounts = std::vector<size_t>(count, 0);
+        ThreadPool::shared().parallelFor(count, [&](size_t i) {
+            size_t index = start + i;
+            answers.at(i) = bindingsForQuery(database, queries.at(index), compiledQueries.at(index), sources.at(index),
+                                             matchCounts.at(i));
+        });
+        for (size_t i = 0; i < count; i += 1) {
+            visit(queries.at(start + i), matchCounts.at(i), answers.at(i));
+        }
+    }
+}
+
+std::string evaluateQueries(Database *database,
+                            DatalogProgram *program,
+                            bool printingHeader,
+                            const CompiledProgram *compiled) {
+    StringSink output = StringSink();
+    evaluateQueries(database, program, output, printingHeader, compiled);
+    return output.takeContents();
 }
 
 // MARK: - Rules
@@ -187,6 +383,72 @@ DependencyGraph* buildDependencyGraph(DatalogProgram *program) {
     return graph;
 }
 
+DatalogProgram* programForQueries(DatalogProgram *program) {
+    DependencyGraph* graph = buildDependencyGraph(program);
+    const map<int, DependencyGraph::Node>& nodes = graph->getNodes();
+    
+    // Start from each rule deriving a queried relation, and follow the rules each one reads from.
+    set<string> usedRelations = set<string>();
+    for (auto query : program->getQueries()) {
+        usedRelations.insert(query->getIdentifier());
+    }
+    
+    set<int> reachable = set<int>();
+    vector<int> unvisited = vector<int>();
+    for (const auto& node : nodes) {
+        if (usedRelations.count(node.second.getName()) != 0) {
+            reachable.insert(node.first);
+            unvisited.push_back(node.first);
+        }
+    }
+    
+    while (!unvisited.empty()) {
+        int nodeID = unvisited.back();
+        unvisited.pop_back();
+        
+        for (const auto& adjacency : nodes.at(nodeID).getAdjacencies()) {
+            if (reachable.insert(adjacency.first).second) {
+                unvisited.push_back(adjacency.first);
+            }
+        }
+    }
+    
+    set<Rule*> reachableRules = set<Rule*>();
+    for (int nodeID : reachable) {
+        Rule* rule = nodes.at(nodeID).getPrimaryRule();
+        reachableRules.insert(rule);
+        
+        usedRelations.insert(rule->getHeadPredicate()->getIdentifier());
+        for (auto predicate : rule->getPredicates()) {
+            usedRelations.insert(predicate->getIdentifier());
+        }
+    }
+    delete graph;
+    
+    DatalogProgram* result = new DatalogProgram(program->getIdentifier());
+    
+    for (auto scheme : program->getSchemes()) {
+        if (usedRelations.count(scheme->getIdentifier()) != 0) {
+            result->addScheme(scheme);
+        }
+    }
+    for (auto fact : program->getFacts()) {
+        if (usedRelations.count(fact->getIdentifier()) != 0) {
+            result->addFact(fact);
+        }
+    }
+    for (auto rule : program->getRules()) {
+        if (reachableRules.count(rule) != 0) {
+            result->addRule(rule);
+        }
+    }
+    for (auto query : program->getQueries()) {
+        result->addQuery(query);
+    }
+    
+    return result;
+}
+
 void invert(DependencyGraph& graph) {
     // Build the reverse dependency graph.
     graph = graph.inverted();
@@ -265,45 +527,114 @@ vector<DependencyGraph> stronglyConnectedComponentsFromGraph(const DependencyGra
     return result;
 }
 
-string evaluateRule(Rule *rule,
-                    Database *database,
-                    bool &didAddToDatabase,
-                    map<std::string, set<std::string>> &printedTuples) {
-    std::ostringstream result = std::ostringstream();
+/// Returns the variables named in @c predicate, in order of first appearance.
+Tuple variablesInPredicate(Predicate* predicate) {
+    Tuple result = Tuple();
+    
+    for (auto item : predicate->getItems()) {
+        if (item.at(0) != '\'' && result.firstIndexOf(item) == -1) {
+            result.push_back(item);
+        }
+    }
+    
+    return result;
+}
+
+/// Keeps only those columns of @c columns which appear in @c live. If none would remain, the first column is kept,
+/// since a relation with no columns cannot hold any rows.
+Tuple liveColumns(const Tuple& columns, const set<string>& live) {
+    Tuple result = Tuple();
+    
+    for (auto col : columns) {
+        if (live.find(col) != live.end()) {
+            result.push_back(col);
+        }
+    }
+    
+    if (result.empty() && !columns.empty()) {
+        result.push_back(columns.front());
+    }
+    
+    return result;
+}
+
+/// Plans which variables each body predicate of @c rule should keep before it is joined.
+///
+/// @param joinProjections Filled with the columns to keep after joining each successive body predicate.
+/// @returns The columns to keep from each body predicate's intermediate relation.
+vector<Tuple> planBodyProjections(Rule *rule, vector<Tuple> &joinProjections) {
+    vector<Predicate*> body = rule->getPredicates();
+    vector<Tuple> bodyVariables = vector<Tuple>();
+    for (auto predicate : body) {
+        bodyVariables.push_back(variablesInPredicate(predicate));
+    }
+    
+    set<string> headVariables = set<string>();
+    for (auto item : rule->getHeadPredicate()->getItems()) {
+        headVariables.insert(item);
+    }
+    
+    // Each body predicate keeps what the head needs, and what it shares with any other body predicate.
+    vector<Tuple> atomProjections = vector<Tuple>();
+    for (size_t i = 0; i < body.size(); i += 1) {
+        set<string> live = headVariables;
+        for (size_t j = 0; j < body.size(); j += 1) {
+            if (j == i) { continue; }
+            live.insert(bodyVariables.at(j).begin(), bodyVariables.at(j).end());
+        }
+        atomProjections.push_back(liveColumns(bodyVariables.at(i), live));
+    }
     
-    result << rule->toString();
+    // After joining predicates 0...i, keep what the head needs, and what the remaining predicates join on.
+    joinProjections.clear();
+    Tuple joined = Tuple();
+    for (size_t i = 0; i < body.size(); i += 1) {
+        joined = joined.combinedWith(atomProjections.at(i));
+        
+        set<string> live = headVariables;
+        for (size_t j = i + 1; j < body.size(); j += 1) {
+            live.insert(bodyVariables.at(j).begin(), bodyVariables.at(j).end());
+        }
+        joinProjections.push_back(liveColumns(joined, live));
+    }
     
-    //  Evaluate the predicates on the right-hand side of the rule
+    return atomProjections;
+}
+
+/// Selects from each of @c sources what its body predicate in @c rule asks for, keeping only the columns in @c atomProjections.
+///
+/// A @c nullptr source skips its predicate.
+vector<Relation> bodyIntermediates(Rule *rule,
+                                   Database *database,
+                                   const vector<const Relation*> &sources,
+                                   const vector<Tuple> &atomProjections) {
     vector<Relation> intermediates = vector<Relation>();
-    vector<string> tuplesToPrint = vector<string>();
     
-    for (auto predicate : rule->getPredicates()) {
-        Relation* relation = database->relationWithName(predicate->getIdentifier());
+    for (size_t i = 0; i < rule->getPredicates().size(); i += 1) {
+        Predicate* predicate = rule->getPredicates().at(i);
+        const Relation* relation = sources.at(i);
         if (relation == nullptr) {
             continue;
         }
         Relation intermediateRelation = Relation(*relation);
-        result << evaluateQueryItem(intermediateRelation, database, predicate, false);
+        evaluateQueryItem(intermediateRelation, database, predicate, false);
+        
+        // Drop the columns nothing downstream reads, so the joins carry narrow rows.
+        intermediateRelation.project(atomProjections.at(i));
         intermediates.push_back(intermediateRelation);
     }
     
-    if (intermediates.empty()) {
-        return result.str();
-    }
-    
-    //  Join the relations that result
-    Relation ruleRelation = *intermediates.begin();
-    if (intermediates.size() > 1) {
-        for (auto relation : intermediates) {
-            ruleRelation = ruleRelation.joinedWith(relation);
-        }
-    }
+    return intermediates;
+}
+
+/// Projects and renames @c ruleRelation to match the scheme of the head relation of @c rule.
+Relation headRelationFrom(Rule *rule, Database *database, Relation &ruleRelation) {
+    Relation* headRelation = database->relationWithName(rule->getHeadPredicate()->getIdentifier());
     
     //  Project the columns that appear in the head predicate
     Tuple newScheme = Tuple(rule->getHeadPredicate()->getItems());
     ruleRelation.project(newScheme);
     ruleRelation.setName(rule->getHeadPredicate()->getIdentifier());
-    Relation* headRelation = database->relationWithName(rule->getHeadPredicate()->getIdentifier());
     
     //  Rename the relation to make it union-compatible
     for (unsigned int i = 0; i < headRelation->getScheme().size(); i += 1) {
@@ -312,52 +643,440 @@ string evaluateRule(Rule *rule,
         ruleRelation.rename(oldCol, newCol);
     }
     
-    for (auto t : headRelation->getContents()) {
-        string key = ruleRelation.getName();
-        string output = headRelation->stringForTuple(t);
-        printedTuples[key].insert(output);
+    return ruleRelation;
+}
+
+/// Joins the intermediate relations of the body of @c rule, then projects and renames the result to match the head
+/// relation's scheme.
+Relation joinBodyIntermediates(Rule *rule,
+                               Database *database,
+                               const vector<Relation> &intermediates,
+                               const vector<Tuple> &joinProjections) {
+    Relation* headRelation = database->relationWithName(rule->getHeadPredicate()->getIdentifier());
+    if (intermediates.empty()) {
+        return Relation(headRelation->getName(), headRelation->getScheme());
+    }
+    
+    //  Join the relations that result
+    Relation ruleRelation = *intermediates.begin();
+    if (intermediates.size() == rule->getPredicates().size()) {
+        for (size_t i = 1; i < intermediates.size(); i += 1) {
+            ruleRelation = ruleRelation.joinedWith(intermediates.at(i));
+            if (i + 1 < intermediates.size()) {
+                ruleRelation.project(joinProjections.at(i));
+            }
+        }
+    } else {
+        // Some predicates named no relation, so the plan's positions no longer line up.
+        for (size_t i = 1; i < intermediates.size(); i += 1) {
+            ruleRelation = ruleRelation.joinedWith(intermediates.at(i));
+        }
+    }
+    
+    return headRelationFrom(rule, database, ruleRelation);
+}
+
+/// Joins the body of @c rule, reading each body predicate from the matching relation in @c sources, then projects and renames
+/// the result to match the head relation's scheme.
+///
+/// A @c nullptr source skips its predicate.
+Relation evaluateRuleBody(Rule *rule,
+                          Database *database,
+                          const vector<const Relation*> &sources) {
+    vector<Tuple> joinProjections = vector<Tuple>();
+    vector<Tuple> atomProjections = planBodyProjections(rule, joinProjections);
+    vector<Relation> intermediates = bodyIntermediates(rule, database, sources, atomProjections);
+    
+    return joinBodyIntermediates(rule, database, intermediates, joinProjections);
+}
+
+/// How many rows of a delta each thread takes at a time.
+static const size_t DELTA_CHUNK_ROWS = 4096;
+
+/// Like @c evaluateRuleBody, where the predicate at @c deltaIndex reads a delta. A large delta is split into ranges which are
+/// joined on separate threads, each probing indexes of the other predicates' relations which are built only once.
+Relation evaluateRuleBodyAcrossDelta(Rule *rule,
+                                     Database *database,
+                                     const vector<const Relation*> &sources,
+                                     size_t deltaIndex) {
+    vector<Tuple> joinProjections = vector<Tuple>();
+    vector<Tuple> atomProjections = planBodyProjections(rule, joinProjections);
+    vector<Relation> intermediates = bodyIntermediates(rule, database, sources, atomProjections);
+    
+    size_t count = rule->getPredicates().size();
+    if (intermediates.size() != count ||
+        intermediates.at(deltaIndex).getContents().size() <= DELTA_CHUNK_ROWS ||
+        ThreadPool::shared().getThreadCount() < 2) {
+        return joinBodyIntermediates(rule, database, intermediates, joinProjections);
+    }
+    
+    // The predicates before the delta don't depend on it, so join them once up front.
+    const Relation& delta = intermediates.at(deltaIndex);
+    Relation prefix = Relation("");
+    JoinIndex prefixIndex = JoinIndex();
+    if (deltaIndex > 0) {
+        prefix = intermediates.front();
+        for (size_t i = 1; i < deltaIndex; i += 1) {
+            prefix = prefix.joinedWith(intermediates.at(i));
+            prefix.project(joinProjections.at(i));
+        }
+        prefixIndex = prefix.joinIndexFor(delta.getScheme());
+    }
+    
+    // Each predicate after the delta is indexed by whichever range first reaches it. Every range reaches it with the same scheme.
+    vector<JoinIndex> indexes = vector<JoinIndex>(count);
+    vector<std::once_flag> isIndexed = vector<std::once_flag>(count);
+    
+    vector<std::set<Tuple>::const_iterator> rangeStarts = vector<std::set<Tuple>::const_iterator>();
+    size_t rowIndex = 0;
+    for (auto row = delta.getContents().begin(); row != delta.getContents().end(); ++row) {
+        if (rowIndex % DELTA_CHUNK_ROWS == 0) {
+            rangeStarts.push_back(row);
+        }
+        rowIndex += 1;
+    }
+    rangeStarts.push_back(delta.getContents().end());
+    
+    vector<Relation> derived = vector<Relation>(rangeStarts.size() - 1, Relation(""));
+    ThreadPool::shared().parallelFor(derived.size(), [&](size_t range) {
+        Relation ruleRelation = Relation(delta.getName(), delta.getScheme());
+        for (auto row = rangeStarts.at(range); row != rangeStarts.at(range + 1); ++row) {
+            ruleRelation.addTuple(*row);
+        }
+        
+        // Columns come out in a different order than joining left to right, but the projections go by name.
+        if (deltaIndex > 0) {
+            ruleRelation = ruleRelation.joinedWith(prefix, prefixIndex);
+            if (deltaIndex + 1 < count) {
+                ruleRelation.project(joinProjections.at(deltaIndex));
+            }
+        }
+        
+        for (size_t i = deltaIndex + 1; i < count; i += 1) {
+            const Relation& other = intermediates.at(i);
+            const Tuple& scheme = ruleRelation.getScheme();
+            std::call_once(isIndexed.at(i), [&]() { indexes.at(i) = other.joinIndexFor(scheme); });
+            
+            ruleRelation = ruleRelation.joinedWith(other, indexes.at(i));
+            if (i + 1 < count) {
+                ruleRelation.project(joinProjections.at(i));
+            }
+        }
+        
+        derived.at(range) = headRelationFrom(rule, database, ruleRelation);
+    });
+    
+    Relation* headRelation = database->relationWithName(rule->getHeadPredicate()->getIdentifier());
+    Relation result = Relation(headRelation->getName(), headRelation->getScheme());
+    for (const auto& relation : derived) {
+        result.insertAll(relation);
+    }
+    
+    return result;
+}
+
+/// Derives what @c rule yields from the database as it stands, without changing anything.
+///
+/// @param deltas If given, the rows added to each recursive relation since @c rule last fired. The rule is then evaluated
+///   once per body predicate which reads one of these relations, with that predicate reading only its delta.
+/// @param compiled If it holds a compiled form of @c rule, that is run in place of joining relations.
+Relation deriveRule(Rule *rule,
+                    Database *database,
+                    const map<string, Relation> *deltas,
+                    const CompiledProgram *compiled) {
+    const CompiledRule* compiledRule = (compiled != nullptr) ? compiled->compiledRule(rule) : nullptr;
+    if (compiledRule != nullptr && compiledRule->isCompiled()) {
+        return (deltas == nullptr) ? compiledRule->derive() : compiledRule->derive(*deltas);
+    }
+    
+    vector<const Relation*> sources = vector<const Relation*>();
+    for (auto predicate : rule->getPredicates()) {
+        sources.push_back(database->relationWithName(predicate->getIdentifier()));
+    }
+    
+    if (deltas == nullptr) {
+        return evaluateRuleBody(rule, database, sources);
+    }
+    
+    Relation* headRelation = database->relationWithName(rule->getHeadPredicate()->getIdentifier());
+    Relation ruleRelation = Relation(headRelation->getName(), headRelation->getScheme());
+    
+    // Anything new must use at least one new row, so let each recursive predicate take its turn reading the delta.
+    for (size_t i = 0; i < sources.size(); i += 1) {
+        auto delta = deltas->find(rule->getPredicates().at(i)->getIdentifier());
+        if (sources.at(i) == nullptr || delta == deltas->end() || delta->second.getContents().empty()) {
+            continue;
+        }
+        
+        vector<const Relation*> variant = sources;
+        variant.at(i) = &delta->second;
+        ruleRelation.insertAll(evaluateRuleBodyAcrossDelta(rule, database, variant, i));
+    }
+    
+    return ruleRelation;
+}
+
+/// Returns @c true if some predicate in the body of @c rule names a relation in @c database.
+static bool readsAnyRelation(Rule *rule, Database *database) {
+    for (auto predicate : rule->getPredicates()) {
+        if (database->relationWithName(predicate->getIdentifier()) != nullptr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Returns @c true if @c rule reads some relation, yet what it derived in @c ruleRelation could not be made union-compatible
+/// with its head relation, so that committing it empties the head relation.
+static bool doesNotFitHead(Rule *rule, const Relation &ruleRelation, Database *database) {
+    Relation* headRelation = database->relationWithName(rule->getHeadPredicate()->getIdentifier());
+    return readsAnyRelation(rule, database) && ruleRelation.getScheme() != headRelation->getScheme();
+}
+
+/// Adds the rows @c rule derived to its head relation.
+///
+/// If @c ruleRelation could not be made union-compatible with the head relation, the head relation is emptied instead.
+///
+/// The trace lists the rows new to the head relation, formatting only those. A row the head relation held before being emptied
+/// was listed already, so it isn't listed again when it comes back.
+///
+/// @param trace Receives the rule's trace for this firing.
+/// @param emptiedRows The rows each head relation held when it was emptied, kept across firings.
+/// @param addedRows If given, receives the rows which were new to the head relation.
+/// @param isIncompatible If given, set to @c true when @c ruleRelation was not union-compatible with the head relation.
+void commitRule(Rule *rule,
+                const Relation &ruleRelation,
+                Database *database,
+                OutputSink &trace,
+                bool &didAddToDatabase,
+                map<string, set<Tuple>> &emptiedRows,
+                vector<Tuple> *addedRows,
+                bool *isIncompatible = nullptr) {
+    trace << rule->toString();
+    
+    if (!readsAnyRelation(rule, database)) {
+        return;
+    }
+    
+    Relation* headRelation = database->relationWithName(rule->getHeadPredicate()->getIdentifier());
+    
+    if (ruleRelation.getScheme() != headRelation->getScheme()) {
+        // Renaming failed, so the union comes out empty and replaces the head relation.
+        if (!headRelation->getContents().empty()) {
+            emptiedRows[headRelation->getName()].insert(headRelation->getContents().begin(), headRelation->getContents().end());
+            *headRelation = Relation(headRelation->getName(), headRelation->getScheme());
+            didAddToDatabase = true;
+        }
+        if (isIncompatible != nullptr) {
+            *isIncompatible = true;
+        }
+        
+        trace << '\n';
+        return;
     }
     
     //  Union with the relation in the database
-    Relation oldHead = *headRelation;
-    ruleRelation = headRelation->unionWith(ruleRelation);
-    if (ruleRelation != oldHead) {
-        didAddToDatabase = true;
-    }
-    
-    if (database->addRelation(new Relation(ruleRelation))) {
-        didAddToDatabase = true;
-        
-        for (Tuple t : ruleRelation.getContents()) {
-            string key = ruleRelation.getName();
-            string output = ruleRelation.stringForTuple(t);
-            if (printedTuples.find(key) == printedTuples.end() ||
-                printedTuples[key].find(output) == printedTuples[key].end()) {
-                // Only print if we've not yet printed this tuple for this relation.
-                tuplesToPrint.push_back(output);
-                // Add output to a vector of tuples printed for ruleRelation.name
-                printedTuples[key].insert(output);
+    Relation added = headRelation->insertAll(ruleRelation);
+    trace << '\n';
+    if (added.getContents().empty()) {
+        return;
+    }
+    didAddToDatabase = true;
+    
+    auto emptied = emptiedRows.find(added.getName());
+    for (const Tuple& t : added.getContents()) {
+        if (emptied == emptiedRows.end() || emptied->second.count(t) == 0) {
+            trace.writeRow(added, t);
+        }
+    }
+    
+    if (addedRows != nullptr) {
+        addedRows->insert(addedRows->end(), added.getContents().begin(), added.getContents().end());
+    }
+}
+
+/// Evaluates @c rule once, adding what it derives to the head relation.
+void evaluateRule(Rule *rule,
+                  Database *database,
+                  OutputSink &trace,
+                  bool &didAddToDatabase,
+                  map<string, set<Tuple>> &emptiedRows,
+                  const map<string, Relation> *deltas = nullptr,
+                  vector<Tuple> *addedRows = nullptr,
+                  const CompiledProgram *compiled = nullptr,
+                  bool *isIncompatible = nullptr) {
+    Relation ruleRelation = deriveRule(rule, database, deltas, compiled);
+    commitRule(rule, ruleRelation, database, trace, didAddToDatabase, emptiedRows, addedRows, isIncompatible);
+}
+
+/// Builds, for each relation in @c rows, a relation holding the rows from index @c from onward.
+map<string, Relation> deltasFromRows(const map<string, vector<Tuple>>& rows,
+                                     const map<string, size_t>& from,
+                                     Database *database) {
+    map<string, Relation> result = map<string, Relation>();
+    
+    for (auto& relationRows : rows) {
+        auto start = from.find(relationRows.first);
+        size_t first = (start == from.end()) ? 0 : start->second;
+        if (first >= relationRows.second.size()) {
+            continue;
+        }
+        
+        Relation* relation = database->relationWithName(relationRows.first);
+        Relation delta = Relation(relation->getName(), relation->getScheme());
+        for (size_t i = first; i < relationRows.second.size(); i += 1) {
+            delta.addTuple(relationRows.second.at(i));
+        }
+        result.insert(std::make_pair(relationRows.first, delta));
+    }
+    
+    return result;
+}
+
+/// Evaluates @c rules in bulk-synchronous passes: each pass, every rule reads the database as it stood when the pass began,
+/// on its own thread, and what they derive is merged in rule order once all of them are done.
+///
+/// A rule whose rows don't fit its head relation empties that relation each time it fires, which only means anything in rule
+/// order, one rule at a time. So should any rule derive such rows, every row the passes added is taken back out and nothing
+/// is traced, leaving the rules to be evaluated one at a time instead.
+///
+/// @returns @c false if the rules must be evaluated one at a time, having changed nothing.
+bool evaluateRulesInSynchronousPasses(const vector<Rule*>& rules,
+                                      Database *database,
+                                      OutputSink& trace,
+                                      int& passCount,
+                                      bool isRecursive,
+                                      const CompiledProgram *compiled) {
+    map<string, set<Tuple>> emptiedRows = map<string, set<Tuple>>();
+    
+    // Held back until the passes are known to finish here.
+    StringSink passTrace = StringSink();
+    int passes = 0;
+    // Every row the passes added to each head relation, to take back out if they must be undone.
+    map<string, vector<Tuple>> allAddedRows = map<string, vector<Tuple>>();
+    
+    // The rows added during the last pass, which this pass reads as deltas. The first pass reads every row.
+    map<string, Relation> deltas = map<string, Relation>();
+    bool isFirstPass = true;
+    bool didAddToDatabase = true;
+    
+    while (didAddToDatabase) {
+        vector<Relation> derived = vector<Relation>(rules.size(), Relation(""));
+        ThreadPool::shared().parallelFor(rules.size(), [&](size_t i) {
+            derived.at(i) = deriveRule(rules.at(i), database, isFirstPass ? nullptr : &deltas, compiled);
+        });
+        
+        for (size_t i = 0; i < rules.size(); i += 1) {
+            if (doesNotFitHead(rules.at(i), derived.at(i), database)) {
+                for (const auto& rows : allAddedRows) {
+                    Relation* relation = database->relationWithName(rows.first);
+                    for (const Tuple& row : rows.second) {
+                        relation->removeTuple(row);
+                    }
+                }
+                return false;
             }
         }
+        
+        // Barrier: fold everything in, in order. Every rule fits its head, so the pass changed the database only if it
+        // added rows.
+        map<string, vector<Tuple>> addedRows = map<string, vector<Tuple>>();
+        for (size_t i = 0; i < rules.size(); i += 1) {
+            string head = rules.at(i)->getHeadPredicate()->getIdentifier();
+            bool didAddRows = false;
+            commitRule(rules.at(i), derived.at(i), database, passTrace, didAddRows, emptiedRows, &addedRows[head]);
+        }
+        
+        didAddToDatabase = false;
+        for (const auto& rows : addedRows) {
+            didAddToDatabase = didAddToDatabase || !rows.second.empty();
+            vector<Tuple>& all = allAddedRows[rows.first];
+            all.insert(all.end(), rows.second.begin(), rows.second.end());
+        }
+        
+        deltas = deltasFromRows(addedRows, map<string, size_t>(), database);
+        isFirstPass = false;
+        
+        passes += 1;
+        if (!isRecursive) { break; } // Run once if we're not recursive.
     }
     
-    result << std::endl;
-    for (auto val : tuplesToPrint) {
-        result << "  " << val << std::endl;
+    trace.write(passTrace.getContents());
+    passCount += passes;
+    return true;
+}
+
+void evaluateRulesToFixedPoint(const vector<Rule*>& rules,
+                               Database *database,
+                               OutputSink& trace,
+                               int& passCount,
+                               bool isRecursive,
+                               const EvaluationOptions& options) {
+    // Compile the rules here if they weren't already.
+    CompiledProgram localProgram = CompiledProgram((options.compiled == nullptr) ? rules : vector<Rule*>(),
+                                                   vector<Predicate*>(), database);
+    const CompiledProgram* compiled = (options.compiled == nullptr) ? &localProgram : options.compiled;
+    
+    if (options.synchronousPasses && rules.size() > 1
+        && evaluateRulesInSynchronousPasses(rules, database, trace, passCount, isRecursive, compiled)) {
+        return;
+    }
+    
+    map<string, set<Tuple>> emptiedRows = map<string, set<Tuple>>();
+    
+    // Every row the rules add to each head relation, in the order they were added.
+    map<string, vector<Tuple>> newRows = map<string, vector<Tuple>>();
+    for (auto rule : rules) {
+        newRows[rule->getHeadPredicate()->getIdentifier()] = vector<Tuple>();
     }
     
-    return result.str();
+    // How many of each relation's new rows each rule had seen when it last fired.
+    map<Rule*, map<string, size_t>> rowsSeen = map<Rule*, map<string, size_t>>();
+    
+    // Set once a rule derives rows which don't fit its head relation. That empties the head relation whenever it fires, so the
+    // new rows no longer tell what changed, and from then on every rule reads everything.
+    bool isIncompatible = false;
+    bool didAddToDatabase = true;
+    
+    while (didAddToDatabase) { // Stop when we've not added any new nodes.
+        didAddToDatabase = false;
+        
+        for (auto rule : rules) { // For each rule...
+            string head = rule->getHeadPredicate()->getIdentifier();
+            auto seen = rowsSeen.find(rule);
+            
+            if (seen == rowsSeen.end() || isIncompatible) {
+                // First time through, the rule reads everything.
+                for (auto& rows : newRows) {
+                    rowsSeen[rule][rows.first] = rows.second.size();
+                }
+                evaluateRule(rule, database, trace, didAddToDatabase, emptiedRows, nullptr, &newRows[head], compiled,
+                             &isIncompatible);
+                continue;
+            }
+            
+            // After that, it reads only what was added since.
+            map<string, Relation> deltas = deltasFromRows(newRows, seen->second, database);
+            for (auto& rows : newRows) {
+                seen->second[rows.first] = rows.second.size();
+            }
+            
+            evaluateRule(rule, database, trace, didAddToDatabase, emptiedRows, &deltas, &newRows[head], compiled);
+        }
+        
+        passCount += 1;
+        if (!isRecursive) { break; } // Run once if we're not recursive.
+    }
 }
 
 // Evaluate the rules in each component.
 //string evaluateRulesInSubgraph(const DependencyGraph& dependencyGraph,
-string evaluateRulesInSubgraph(const set<pair<int, Rule*>>& subgraph,
-                               const DependencyGraph* depGraph,
-                               Database *database,
-                               int& passCount) {
-    std::ostringstream result = std::ostringstream();
-    map<string, set<string>> printedTuples = map<string, set<string>>();
-    
+void evaluateRulesInSubgraph(const set<pair<int, Rule*>>& subgraph,
+                             const DependencyGraph* depGraph,
+                             Database *database,
+                             OutputSink& trace,
+                             int& passCount,
+                               const EvaluationOptions& options) {
     // If we've other nodes, we'll need to run a fixed-point algorithm.
     bool isRecursiveDependent = true;
     if (subgraph.size() == 1) {
@@ -368,87 +1087,165 @@ string evaluateRulesInSubgraph(const set<pair<int, Rule*>>& subgraph,
     }
     
     // Evaluate our rules
-    bool didAddToDatabase = true;
+    vector<Rule*> rules = vector<Rule*>();
+    for (auto rulePair : subgraph) {
+        rules.push_back(rulePair.second);
+    }
     
-    while (didAddToDatabase) { // Stop when we've not added any new nodes.
-        didAddToDatabase = false;
-        
-        for (auto rulePair : subgraph) { // For each rule...
-            Rule* rule = rulePair.second;
-            result << evaluateRule(rule, database, didAddToDatabase, printedTuples);
+    evaluateRulesToFixedPoint(rules, database, trace, passCount, isRecursiveDependent, options);
+}
+
+
+// MARK: - Evaluate
+
+/// Evaluates the rules of one strongly-connected component.
+///
+/// @param trace Receives the component's trace, from its "SCC:" line through its pass count.
+void evaluateComponent(const DependencyGraph& subgraph,
+                       const DependencyGraph* dependencies,
+                       Database *database,
+                       OutputSink& trace,
+                       const EvaluationOptions& options) {
+    trace << "SCC: " << subgraph.verticesByIDToString() << '\n';
+    
+    int passCount = 0;
+    if (!subgraph.getNodes().empty()) {
+        // Represent the subgraph as a set
+        set<pair<int, Rule*>> subgraphSet = set<pair<int, Rule*>>();
+        for (auto nodePair : subgraph.getNodes()) {
+            subgraphSet.insert(std::make_pair(nodePair.first, nodePair.second.getPrimaryRule()));
         }
         
-        passCount += 1;
-        if (!isRecursiveDependent) { break; } // Run once if we're not recursive.
+        evaluateRulesInSubgraph(subgraphSet, dependencies, database, trace, passCount, options);
     }
     
-    return result.str();
+    trace << std::to_string(passCount) << " passes: " << subgraph.verticesByIDToString() << '\n';
 }
 
+vector<vector<size_t>> componentSuccessors(const vector<DependencyGraph>& components) {
+    vector<set<string>> reads = vector<set<string>>();
+    vector<set<string>> writes = vector<set<string>>();
+    for (const auto& component : components) {
+        reads.push_back(set<string>());
+        writes.push_back(set<string>());
+        for (auto nodePair : component.getNodes()) {
+            Rule* rule = nodePair.second.getPrimaryRule();
+            writes.back().insert(rule->getHeadPredicate()->getIdentifier());
+            for (auto predicate : rule->getPredicates()) {
+                reads.back().insert(predicate->getIdentifier());
+            }
+        }
+    }
+    
+    auto overlaps = [](const set<string>& a, const set<string>& b) {
+        for (const auto& name : a) {
+            if (b.find(name) != b.end()) {
+                return true;
+            }
+        }
+        return false;
+    };
+    
+    vector<vector<size_t>> result = vector<vector<size_t>>(components.size());
+    for (size_t i = 0; i < components.size(); i += 1) {
+        for (size_t j = i + 1; j < components.size(); j += 1) {
+            if (overlaps(writes.at(i), reads.at(j)) ||
+                overlaps(writes.at(i), writes.at(j)) ||
+                overlaps(reads.at(i), writes.at(j))) {
+                result.at(i).push_back(j);
+            }
+        }
+    }
+    
+    return result;
+}
 
-// MARK: - Evaluate
-
-string evaluateRules(Database *database, DatalogProgram *program, bool optimizeDependencies) {
-    std::ostringstream str = std::ostringstream();
+vector<size_t> criticalPathLengths(const vector<DependencyGraph>& components,
+                                   const vector<vector<size_t>>& successors) {
+    vector<size_t> result = vector<size_t>(components.size(), 0);
+    
+    // Successors always come later, so walk backwards.
+    for (size_t i = components.size(); i > 0; i -= 1) {
+        size_t longestAfter = 0;
+        for (auto next : successors.at(i - 1)) {
+            longestAfter = std::max(longestAfter, result.at(next));
+        }
+        result.at(i - 1) = components.at(i - 1).getNodes().size() + longestAfter;
+    }
+    
+    return result;
+}
 
+void evaluateRules(Database *database,
+                   DatalogProgram *program,
+                   OutputSink& trace,
+                   bool optimizeDependencies,
+                   const EvaluationOptions& evaluationOptions) {
+    // Compile the rules once, for every component to share.
+    EvaluationOptions options = evaluationOptions;
+    CompiledProgram compiled = CompiledProgram((options.compiled == nullptr) ? program->getRules() : vector<Rule*>(),
+                                               vector<Predicate*>(), database);
+    if (options.compiled == nullptr) {
+        options.compiled = &compiled;
+    }
+    
     DependencyGraph* dependencies = buildDependencyGraph(program);
     vector<DependencyGraph> components;
     
     if (optimizeDependencies) {
-        str << "Dependency Graph" << std::endl;
-        str << dependencies->toString() << std::endl;
+        trace << "Dependency Graph\n";
+        trace << dependencies->toString() << '\n';
         stronglyConnectedComponentsFromGraphReference(dependencies, components);
         
     } else {
         components = { *dependencies };
     }
     
-    str << "Rule Evaluation" << std::endl;
-    for (auto subgraph : components) {
-        if (optimizeDependencies) {
-            str << "SCC: " << subgraph.verticesByIDToString() << std::endl;
-        }
-        
-        int passCount = 0;
+    trace << "Rule Evaluation\n";
+    if (optimizeDependencies && ThreadPool::shared().getThreadCount() > 1 && components.size() > 1) {
+        // Components that share no relation they write can run at once. Each buffers its own trace.
+        vector<StringSink> traces = vector<StringSink>(components.size());
+        vector<vector<size_t>> successors = componentSuccessors(components);
+        vector<size_t> priority = criticalPathLengths(components, successors);
+        ThreadPool::shared().runTaskGraph(successors, priority, [&](size_t index) {
+            evaluateComponent(components.at(index), dependencies, database, traces.at(index), options);
+        });
         
-        if (optimizeDependencies) {
-            if (!subgraph.getNodes().empty()) {
-                // Represent the subgraph as a set
-                set<pair<int, Rule*>> subgraphSet = set<pair<int, Rule*>>();
-                for (auto nodePair : subgraph.getNodes()) {
-                    subgraphSet.insert(std::make_pair(nodePair.first, nodePair.second.getPrimaryRule()));
-                }
-                
-                str << evaluateRulesInSubgraph(subgraphSet, dependencies, database, passCount);
-            }
-        } else {
-            bool didAddToDatabase = true;
-            map<string, set<string>> printedTuples = map<string, set<string>>();
-            while (didAddToDatabase) {
-                didAddToDatabase = false;
-                for (auto node : subgraph.getNodes()) {
-                    Rule* rule = node.second.getPrimaryRule();
-                    str << evaluateRule(rule, database, didAddToDatabase, printedTuples);
-                }
-                passCount += 1;
-            }
+        for (const auto& componentTrace : traces) {
+            trace.write(componentTrace.getContents());
         }
         
-        if (optimizeDependencies) {
-            str << passCount << " passes: " << subgraph.verticesByIDToString() << std::endl;
-        } else {
-            str << std::endl << "Schemes populated after " << passCount
-                << " passes through the Rules." << std::endl << std::endl;
+    } else if (optimizeDependencies) {
+        for (const auto& component : components) {
+            evaluateComponent(component, dependencies, database, trace, options);
         }
         
-        passCount = 0;
+    } else {
+        for (auto subgraph : components) {
+            int passCount = 0;
+            
+            vector<Rule*> rules = vector<Rule*>();
+            for (auto node : subgraph.getNodes()) {
+                rules.push_back(node.second.getPrimaryRule());
+            }
+            evaluateRulesToFixedPoint(rules, database, trace, passCount, true, options);
+            
+            trace << "\nSchemes populated after " << std::to_string(passCount) << " passes through the Rules.\n\n";
+        }
     }
     
     if (optimizeDependencies) {
-        str << std::endl;
+        trace << '\n';
     }
     
     delete dependencies;
-    
-    return str.str();
+}
+
+string evaluateRules(Database *database,
+                     DatalogProgram *program,
+                     bool optimizeDependencies,
+                     const EvaluationOptions& options) {
+    StringSink trace = StringSink();
+    evaluateRules(database, program, trace, optimizeDependencies, options);
+    return trace.takeContents();
 }
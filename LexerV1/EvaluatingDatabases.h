@@ -12,11 +12,14 @@
 #include "Database.h"
 #include "DatalogProgram.h"
 #include "DependencyGraph.h"
+#include "CompiledProgram.h"
+#include "OutputSink.h"
 #include <string>
 #include <sstream>
 #include <vector>
 #include <map>
 #include <stack>
+#include <functional>
 
 using std::string;
 using std::vector;
@@ -25,30 +28,95 @@ using std::map;
 using std::pair;
 using std::stack;
 
+/// Settings for how rules are evaluated.
+struct EvaluationOptions {
+    /// Evaluate every rule of a pass at once, each against the database as it stood when the pass began, and merge
+    /// what they derive when all are done. Rules then see each other's rows one pass later, so the trace and pass counts
+    /// may differ from evaluating rules one after another.
+    bool synchronousPasses = false;
+    
+    /// The program's rules, compiled ahead of time so that they can be reused across runs. If not given, rules are
+    /// compiled when evaluation begins.
+    const CompiledProgram* compiled = nullptr;
+};
+
 int extern indexOfValueInVector(string query, const vector<string> &domain);
 
 void extern evaluateSchemes(Database *database,
                             DatalogProgram *program);
 void extern evaluateFacts(Database *database,
                           DatalogProgram *program);
+/// Selects the rows of @c result which @c query matches, then projects and renames them to the query's variables.
+///
+/// @param matchCount If given, receives how many rows matched before they were projected.
+/// @returns "Yes(n)" or "No" on a line, if @c outputSuccess.
 string extern evaluateQueryItem(Relation &result,
                                 Database *database,
                                 Predicate *query,
-                                bool outputSuccess = true);
+                                bool outputSuccess = true,
+                                size_t *matchCount = nullptr);
+/// Answers each of @c program's queries, spread across the shared thread pool, and writes the answers to @c output in the
+/// order the queries were given, as they're ready. Whitespace ending the answers is left out.
+void extern evaluateQueries(Database *database,
+                            DatalogProgram *program,
+                            OutputSink &output,
+                            bool printingHeader = true,
+                            const CompiledProgram *compiled = nullptr);
+/// Answers each of @c program's queries as @c evaluateQueries does, but hands @c visit each answer in the order the queries
+/// were given, rather than writing it out: the query, how many rows it matched, and the distinct bindings of its variables.
+void forEachQueryAnswer(Database *database,
+                        DatalogProgram *program,
+                        const std::function<void(Predicate*, size_t, const Relation&)>& visit,
+                        const CompiledProgram *compiled = nullptr);
+/// Answers each of @c program's queries as the streaming @c evaluateQueries does, returning the answers.
 string extern evaluateQueries(Database *database,
                               DatalogProgram *program,
-                              bool printingHeader = true);
-string evaluateRulesInSubgraph(const set<pair<int, Rule*>>& subgraph,
-                               const DependencyGraph* depGraph,
+                              bool printingHeader = true,
+                              const CompiledProgram *compiled = nullptr);
+/// Evaluates @c rules semi-naively until none of them adds anything to the database, or only once if they aren't @c isRecursive.
+///
+/// After its first firing, each rule reads only the rows added to the relations it depends on since it last fired.
+void evaluateRulesToFixedPoint(const vector<Rule*>& rules,
                                Database *database,
-                               int& passCount);
+                               OutputSink& trace,
+                               int& passCount,
+                               bool isRecursive,
+                               const EvaluationOptions& options = EvaluationOptions());
+void evaluateRulesInSubgraph(const set<pair<int, Rule*>>& subgraph,
+                             const DependencyGraph* depGraph,
+                             Database *database,
+                             OutputSink& trace,
+                             int& passCount,
+                             const EvaluationOptions& options = EvaluationOptions());
+/// Evaluates @c program's rules, writing their trace to @c trace as it goes.
+void extern evaluateRules(Database *database,
+                          DatalogProgram *program,
+                          OutputSink& trace,
+                          bool optimizeDependencies = false,
+                          const EvaluationOptions& options = EvaluationOptions());
+/// Evaluates @c program's rules as the streaming @c evaluateRules does, returning their trace.
 string extern evaluateRules(Database *database,
                             DatalogProgram *program,
-                            bool optimizeDependencies = false);
+                            bool optimizeDependencies = false,
+                            const EvaluationOptions& options = EvaluationOptions());
+
+/// Lists, for each of @c components, the later components which must wait for it to finish: those which read what it writes,
+/// write what it reads, or write what it writes.
+vector<vector<size_t>> componentSuccessors(const vector<DependencyGraph>& components);
+
+/// Estimates, for each of @c components, the work along the longest chain of @c successors starting from it.
+vector<size_t> criticalPathLengths(const vector<DependencyGraph>& components,
+                                   const vector<vector<size_t>>& successors);
 
 /// Lists all dependent and independent rules in the given @c program.
 DependencyGraph* buildDependencyGraph(DatalogProgram *program);
 
+/// Returns a copy of @c program holding only the rules which its queries depend on, and the schemes and facts of the
+/// relations those rules and queries read or write.
+///
+/// The copy retains what it shares with @c program, so either may be deleted first.
+DatalogProgram* programForQueries(DatalogProgram *program);
+
 /// Reverses the direction of each edge in @c graph.
 void invert(DependencyGraph& graph);
 
@@ -0,0 +1,288 @@
+//
+//  FactFiles.cpp
+//  LexerV1
+//
+//  Created by James Robinson on 1/3/20.
+//
+
+#include "FactFiles.h"
+#include <algorithm>
+#include <iterator>
+#include <sstream>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ThreadPool.h"
+
+/// How much of a file each chunk parses, at least.
+const size_t CHUNK_BYTES = 1 << 16;
+
+// MARK: - Naming files
+
+bool factFileFromArgument(const std::string& argument, FactFile& file) {
+    size_t equals = argument.find('=');
+    if (equals == std::string::npos || equals == 0 || equals + 1 == argument.size()) {
+        return false;
+    }
+    
+    file.relationName = argument.substr(0, equals);
+    file.path = argument.substr(equals + 1);
+    return true;
+}
+
+std::vector<FactFile> factFilesInTokens(const std::vector<Token*>& tokens, const std::string& directory) {
+    std::vector<FactFile> result = std::vector<FactFile>();
+    
+    for (auto token : tokens) {
+        if (token->getType() != COMMENT || token->getValue().compare(0, 6, "#load ") != 0) {
+            continue;
+        }
+        
+        FactFile file = FactFile();
+        std::istringstream words = std::istringstream(token->getValue().substr(6));
+        if (!(words >> file.relationName >> file.path)) {
+            continue;
+        }
+        if (file.path.front() != '/' && !directory.empty()) {
+            file.path = directory + "/" + file.path;
+        }
+        result.push_back(file);
+    }
+    
+    return result;
+}
+
+// MARK: - Parsing
+
+/// Returns @c value as the program would write it: in quotes, with each quote within it doubled.
+static std::string quotedValue(const char* value, size_t length) {
+    std::string result = std::string();
+    result.reserve(length + 2);
+    result.push_back('\'');
+    for (size_t i = 0; i < length; i += 1) {
+        if (value[i] == '\'') {
+            result.push_back('\'');
+        }
+        result.push_back(value[i]);
+    }
+    result.push_back('\'');
+    return result;
+}
+
+/// Splits @c line into its fields, unescaping them.
+static void fieldsOfLine(const char* line, size_t length, bool isCSV, std::vector<std::string>& fields) {
+    fields.clear();
+    std::string field = std::string();
+    
+    for (size_t i = 0; i <= length; i += 1) {
+        if (i == length || line[i] == (isCSV ? ',' : '\t')) {
+            fields.push_back(field);
+            field.clear();
+            
+        } else if (isCSV && line[i] == '"' && field.empty()) {
+            // A quoted field runs to the next lone quote.
+            for (i += 1; i < length; i += 1) {
+                if (line[i] == '"' && i + 1 < length && line[i + 1] == '"') {
+                    field.push_back('"');
+                    i += 1;
+                } else if (line[i] == '"') {
+                    break;
+                } else {
+                    field.push_back(line[i]);
+                }
+            }
+            
+        } else if (!isCSV && line[i] == '\\' && i + 1 < length) {
+            i += 1;
+            switch (line[i]) {
+                case 't': field.push_back('\t'); break;
+                case 'n': field.push_back('\n'); break;
+                case 'r': field.push_back('\r'); break;
+                default: field.push_back(line[i]); break;
+            }
+            
+        } else {
+            field.push_back(line[i]);
+        }
+    }
+}
+
+/// Returns @c true if @c line is the answer line which begins each block of @c writeQueryResults' TSV and CSV, such as
+/// "# r(X,Y)? Yes(2)", and so is followed by a header naming the query's variables.
+static bool isAnswerLine(const char* line, size_t length) {
+    std::string text = std::string(line, length);
+    if (text.compare(0, 2, "# ") != 0) {
+        return false;
+    }
+    if (text.size() >= 5 && text.compare(text.size() - 4, 4, "? No") == 0) {
+        return true;
+    }
+    size_t yes = text.rfind("? Yes(");
+    return yes != std::string::npos && text.back() == ')' && yes + 7 < text.size()
+        && text.find_first_not_of("0123456789", yes + 6) == text.size() - 1;
+}
+
+/// The rows of one chunk of a file.
+struct ParsedChunk {
+    std::vector<Tuple> rows;
+    size_t lineCount = 0;
+    /// The line within the chunk, counting from 1, which held the wrong number of fields, or 0 if none did.
+    size_t badLine = 0;
+    size_t badFieldCount = 0;
+};
+
+/// Parses the lines from @c begin up to @c end, each ending at a newline, into rows of @c scheme.
+///
+/// @param followsAnswerLine Whether the line before @c begin is an answer line, making the chunk's first line a header.
+static ParsedChunk parseChunk(const char* begin,
+                              const char* end,
+                              bool isCSV,
+                              bool isFirstChunk,
+                              bool followsAnswerLine,
+                              const Tuple& scheme) {
+    ParsedChunk chunk = ParsedChunk();
+    std::vector<std::string> fields = std::vector<std::string>();
+    bool isHeader = followsAnswerLine;
+    
+    for (const char* line = begin; line < end;) {
+        const char* lineEnd = static_cast<const char*>(memchr(line, '\n', static_cast<size_t>(end - line)));
+        if (lineEnd == nullptr) {
+            lineEnd = end;
+        }
+        const char* next = lineEnd + ((lineEnd < end) ? 1 : 0);
+        if (lineEnd > line && lineEnd[-1] == '\r') {
+            lineEnd -= 1;
+        }
+        chunk.lineCount += 1;
+        
+        size_t length = static_cast<size_t>(lineEnd - line);
+        bool wasHeader = isHeader;
+        isHeader = (length > 0 && isAnswerLine(line, length));
+        if (length == 0 || line[0] == '#') {
+            line = next;
+            continue;
+        }
+        
+        fieldsOfLine(line, length, isCSV, fields);
+        line = next;
+        
+        if (wasHeader || (isFirstChunk && chunk.lineCount == 1 && fields == scheme)) {
+            continue; // The file's header, or that of a query's results.
+        }
+        if (fields.size() != scheme.size()) {
+            chunk.badLine = chunk.lineCount;
+            chunk.badFieldCount = fields.size();
+            break;
+        }
+        
+        Tuple row = Tuple(std::vector<std::string>(fields.size()));
+        for (size_t col = 0; col < fields.size(); col += 1) {
+            row[col] = quotedValue(fields[col].data(), fields[col].size());
+        }
+        chunk.rows.push_back(std::move(row));
+    }
+    
+    std::sort(chunk.rows.begin(), chunk.rows.end());
+    return chunk;
+}
+
+// MARK: - Loading
+
+bool loadFactFile(Relation* relation, const std::string& path, std::string& error) {
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        error = "The file '" + path + "' could not be opened.";
+        return false;
+    }
+    
+    struct stat status = {};
+    if (fstat(file, &status) != 0) {
+        close(file);
+        error = "The file '" + path + "' could not be read.";
+        return false;
+    }
+    size_t size = static_cast<size_t>(status.st_size);
+    if (size == 0) {
+        close(file);
+        return true;
+    }
+    
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapped == MAP_FAILED) {
+        error = "The file '" + path + "' could not be read.";
+        return false;
+    }
+    const char* bytes = static_cast<const char*>(mapped);
+    const char* end = bytes + size;
+    
+    // Split the file into chunks of whole lines, a few for each thread.
+    size_t chunkCount = std::max<size_t>(1, std::min(ThreadPool::shared().getThreadCount() * 4, size / CHUNK_BYTES));
+    std::vector<const char*> starts = { bytes };
+    for (size_t i = 1; i < chunkCount; i += 1) {
+        const char* start = std::max(bytes + size * i / chunkCount, starts.back());
+        const char* newline = static_cast<const char*>(memchr(start, '\n', static_cast<size_t>(end - start)));
+        if (newline == nullptr) {
+            break;
+        }
+        starts.push_back(newline + 1);
+    }
+    starts.push_back(end);
+    
+    bool isCSV = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+    std::vector<ParsedChunk> chunks = std::vector<ParsedChunk>(starts.size() - 1);
+    ThreadPool::shared().parallelFor(chunks.size(), [&](size_t i) {
+        // Each chunk but the first begins after a newline; find the line that newline ends.
+        bool followsAnswerLine = false;
+        if (i > 0) {
+            const char* lineEnd = starts.at(i) - 1;
+            const char* line = lineEnd;
+            while (line > bytes && line[-1] != '\n') {
+                line -= 1;
+            }
+            if (lineEnd > line && lineEnd[-1] == '\r') {
+                lineEnd -= 1;
+            }
+            followsAnswerLine = isAnswerLine(line, static_cast<size_t>(lineEnd - line));
+        }
+        chunks.at(i) = parseChunk(starts.at(i), starts.at(i + 1), isCSV, i == 0, followsAnswerLine, relation->getScheme());
+    });
+    munmap(mapped, size);
+    
+    size_t linesBefore = 0;
+    for (const auto& chunk : chunks) {
+        if (chunk.badLine != 0) {
+            error = path + ":" + std::to_string(linesBefore + chunk.badLine) + " has " + std::to_string(chunk.badFieldCount)
+                + " fields, but " + relation->getName() + " has " + std::to_string(relation->getColumnCount()) + " columns.";
+            return false;
+        }
+        linesBefore += chunk.lineCount;
+    }
+    
+    // Merge the sorted chunks pairwise, each round's merges at once, until one holds every row.
+    std::vector<std::vector<Tuple>> runs = std::vector<std::vector<Tuple>>();
+    for (auto& chunk : chunks) {
+        runs.push_back(std::move(chunk.rows));
+    }
+    while (runs.size() > 1) {
+        std::vector<std::vector<Tuple>> merged = std::vector<std::vector<Tuple>>((runs.size() + 1) / 2);
+        ThreadPool::shared().parallelFor(merged.size(), [&](size_t i) {
+            if (2 * i + 1 == runs.size()) {
+                merged.at(i) = std::move(runs.at(2 * i));
+                return;
+            }
+            std::vector<Tuple>& left = runs.at(2 * i);
+            std::vector<Tuple>& right = runs.at(2 * i + 1);
+            merged.at(i).reserve(left.size() + right.size());
+            std::merge(std::make_move_iterator(left.begin()), std::make_move_iterator(left.end()),
+                       std::make_move_iterator(right.begin()), std::make_move_iterator(right.end()),
+                       std::back_inserter(merged.at(i)));
+        });
+        runs = std::move(merged);
+    }
+    
+    relation->addTuples(runs.front());
+    return true;
+}
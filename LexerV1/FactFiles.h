@@ -0,0 +1,46 @@
+//
+//  FactFiles.h
+//  LexerV1
+//
+//  Created by James Robinson on 1/3/20.
+//
+
+#ifndef FactFiles_h
+#define FactFiles_h
+
+#include <string>
+#include <vector>
+#include "Token.h"
+#include "Relation.h"
+
+/// A delimited file whose rows are loaded into a relation as facts.
+struct FactFile {
+    std::string relationName;
+    std::string path;
+};
+
+/// Reads a fact file given on the command line as @c relation=path.
+///
+/// @returns @c false if @c argument isn't of that form.
+bool factFileFromArgument(const std::string& argument, FactFile& file);
+
+/// Finds the fact files a program names in comments of the form @c #load @c relation @c path, such as one written beside
+/// the relation's scheme. A relative path is taken from @c directory.
+std::vector<FactFile> factFilesInTokens(const std::vector<Token*>& tokens, const std::string& directory);
+
+/// Adds the rows of a delimited file to @c relation.
+///
+/// Fields are separated by commas if the path ends in ".csv", and by tabs otherwise, just as @c writeQueryResults writes
+/// them. TSV fields unescape \\, \t, \n, \r and \#, and CSV fields may be quoted, though not across lines.
+/// Blank lines, lines beginning with "#", and a first line naming the relation's columns are skipped, as is the header
+/// after each answer line, so that a single query's results read back as its rows. Each value is stored as the program
+/// would write it, in quotes.
+///
+/// The file is mapped into memory and parsed in chunks spread across the shared thread pool. Each chunk's rows are
+/// sorted and merged, then added in order, so the relation places each one after the last.
+///
+/// @returns @c false if the file couldn't be read or a line has the wrong number of fields, in which case @c error says
+/// why and nothing is added.
+bool loadFactFile(Relation* relation, const std::string& path, std::string& error);
+
+#endif /* FactFiles_h */
@@ -0,0 +1,330 @@
+//
+//  IncrementalEvaluator.cpp
+//  LexerV1
+//
+//  Created by James Robinson on 12/27/19.
+//
+
+#include "IncrementalEvaluator.h"
+#include "EvaluatingDatabases.h"
+#include "DependencyGraph.h"
+
+/// Returns the rows of @c relation kept in @c rows, adding an empty set of them if there are none yet.
+Relation& rowsOfRelation(std::map<std::string, Relation>& rows, const Relation* relation) {
+    auto found = rows.find(relation->getName());
+    if (found == rows.end()) {
+        found = rows.insert(std::make_pair(relation->getName(), Relation(relation->getName(), relation->getScheme()))).first;
+    }
+    return found->second;
+}
+
+IncrementalEvaluator::IncrementalEvaluator(DatalogProgram* program, Database* database) {
+    this->program = program;
+    this->database = database;
+    this->unsupportedReason = "";
+    
+    for (auto fact : program->getFacts()) {
+        Relation* relation = database->relationWithName(fact->getIdentifier());
+        if (relation != nullptr && fact->getItems().size() == relation->getColumnCount()) {
+            facts[relation->getName()].insert(Tuple(fact->getItems()));
+        }
+    }
+    
+    std::set<std::string> derivedNames = std::set<std::string>();
+    for (auto rule : program->getRules()) {
+        derivedNames.insert(rule->getHeadPredicate()->getIdentifier());
+    }
+    for (auto relation : database->getRelations()) {
+        if (derivedNames.count(relation->getName()) == 0) {
+            facts[relation->getName()] = relation->getContents();
+        }
+    }
+    
+    std::map<Rule*, size_t> ruleIndexes = std::map<Rule*, size_t>();
+    for (auto rule : program->getRules()) {
+        ruleIndexes[rule] = compiledRules.size();
+        compiledRules.push_back(CompiledRule(rule, database));
+        headRelations.push_back(database->relationWithName(rule->getHeadPredicate()->getIdentifier()));
+        
+        const CompiledRule& compiled = compiledRules.back();
+        if (unsupportedReason.empty() && !compiled.isCompiled()) {
+            unsupportedReason = compiled.getUnsupportedReason();
+        } else if (unsupportedReason.empty() && !compiled.isUnionCompatible()) {
+            unsupportedReason = rule->toString() + " derives rows which don't fit " + headRelations.back()->getName();
+        }
+    }
+    
+    if (!canMaintain()) {
+        return;
+    }
+    
+    // Group the rules as evaluateRules does.
+    DependencyGraph* dependencies = buildDependencyGraph(program);
+    std::vector<DependencyGraph> graphs = std::vector<DependencyGraph>();
+    stronglyConnectedComponentsFromGraphReference(dependencies, graphs);
+    delete dependencies;
+    
+    for (const auto& graph : graphs) {
+        components.push_back(std::vector<size_t>());
+        componentReads.push_back(std::set<std::string>());
+        for (const auto& node : graph.getNodes()) {
+            Rule* rule = node.second.getPrimaryRule();
+            components.back().push_back(ruleIndexes.at(rule));
+            for (auto predicate : rule->getPredicates()) {
+                componentReads.back().insert(predicate->getIdentifier());
+            }
+        }
+    }
+    
+    for (size_t i = 0; i < compiledRules.size(); i += 1) {
+        Rule* rule = compiledRules.at(i).getRule();
+        Predicate* head = rule->getHeadPredicate();
+        
+        Predicate* rederivingHead = new Predicate(head->getType(), head->getIdentifier());
+        rederivingHead->copyItemsIn(head->getItems());
+        Predicate* candidates = new Predicate(RULES, head->getIdentifier());
+        candidates->copyItemsIn(head->getItems());
+        
+        std::vector<Predicate*> body = { candidates };
+        for (auto predicate : rule->getPredicates()) {
+            body.push_back(predicate);
+        }
+        
+        Rule* rederivingRule = new Rule();
+        rederivingRule->setHeadPredicate(rederivingHead);
+        rederivingRule->setPredicates(body);
+        rederivingRules.push_back(rederivingRule);
+        compiledRederivingRules.push_back(CompiledRule(rederivingRule, database));
+    }
+    
+    indexRelations();
+}
+
+IncrementalEvaluator::~IncrementalEvaluator() {
+    for (auto rule : rederivingRules) {
+        delete rule;
+    }
+    rederivingRules.clear();
+}
+
+bool IncrementalEvaluator::canMaintain() const {
+    return unsupportedReason.empty();
+}
+
+std::string IncrementalEvaluator::getUnsupportedReason() const {
+    return unsupportedReason;
+}
+
+// MARK: - Rows
+
+void IncrementalEvaluator::indexRelations() {
+    indexes = MaintainedIndexes();
+    
+    // Index everything the delta plans look up, since those are all that updates run.
+    for (size_t i = 0; i < compiledRules.size(); i += 1) {
+        for (size_t j = 0; j < compiledRules.at(i).getRule()->getPredicates().size(); j += 1) {
+            if (compiledRules.at(i).getDeltaPlan(j) != nullptr) {
+                indexes.addIndexesFor(*compiledRules.at(i).getDeltaPlan(j));
+            }
+        }
+        if (compiledRederivingRules.at(i).getDeltaPlan(0) != nullptr) {
+            indexes.addIndexesFor(*compiledRederivingRules.at(i).getDeltaPlan(0));
+        }
+    }
+}
+
+bool IncrementalEvaluator::addRow(Relation* relation, const Tuple& row) {
+    if (row.size() != relation->getColumnCount() || relation->getContents().count(row) != 0) {
+        return false;
+    }
+    
+    relation->addTuple(row);
+    indexes.rowAdded(relation, &*relation->getContents().find(row));
+    return true;
+}
+
+void IncrementalEvaluator::removeRow(Relation* relation, const Tuple& row) {
+    auto found = relation->getContents().find(row);
+    if (found == relation->getContents().end()) {
+        return;
+    }
+    
+    indexes.rowRemoving(relation, &*found);
+    relation->removeTuple(row);
+}
+
+std::map<std::string, Relation> IncrementalEvaluator::rowsReadBy(size_t component,
+                                                                 const std::map<std::string, Relation>& rows) const {
+    std::map<std::string, Relation> result = std::map<std::string, Relation>();
+    for (const auto& relationRows : rows) {
+        if (componentReads.at(component).count(relationRows.first) != 0 && !relationRows.second.getContents().empty()) {
+            result.insert(relationRows);
+        }
+    }
+    return result;
+}
+
+void IncrementalEvaluator::propagate(size_t component,
+                                     std::map<std::string, Relation> deltas,
+                                     std::map<std::string, Relation>& added) {
+    while (!deltas.empty()) {
+        std::map<std::string, Relation> nextDeltas = std::map<std::string, Relation>();
+        
+        for (auto ruleIndex : components.at(component)) {
+            Relation* head = headRelations.at(ruleIndex);
+            Relation derived = compiledRules.at(ruleIndex).derive(deltas, &indexes);
+            for (const Tuple& row : derived.getContents()) {
+                if (addRow(head, row)) {
+                    rowsOfRelation(nextDeltas, head).addTuple(row);
+                    rowsOfRelation(added, head).addTuple(row);
+                }
+            }
+        }
+        
+        deltas = nextDeltas;
+    }
+}
+
+// MARK: - Updating
+
+size_t IncrementalEvaluator::deleteFacts(const std::vector<Predicate*>& deletedFacts) {
+    // Rows which may no longer be derivable, starting with the deleted facts themselves.
+    std::map<std::string, Relation> overDeleted = std::map<std::string, Relation>();
+    size_t deletedCount = 0;
+    for (auto fact : deletedFacts) {
+        Relation* relation = database->relationWithName(fact->getIdentifier());
+        Tuple row = Tuple(fact->getItems());
+        if (relation != nullptr && facts[relation->getName()].erase(row) != 0) {
+            rowsOfRelation(overDeleted, relation).addTuple(row);
+            deletedCount += 1;
+        }
+    }
+    if (overDeleted.empty()) {
+        return 0;
+    }
+    
+    // Find everything a deleted row helped derive, while every row is still there to join with.
+    for (size_t component = 0; component < components.size(); component += 1) {
+        std::map<std::string, Relation> deltas = rowsReadBy(component, overDeleted);
+        
+        while (!deltas.empty()) {
+            std::map<std::string, Relation> nextDeltas = std::map<std::string, Relation>();
+            
+            for (auto ruleIndex : components.at(component)) {
+                Relation* head = headRelations.at(ruleIndex);
+                Relation& deleted = rowsOfRelation(overDeleted, head);
+                Relation derived = compiledRules.at(ruleIndex).derive(deltas, &indexes);
+                
+                for (const Tuple& row : derived.getContents()) {
+                    if (head->getContents().count(row) != 0 && deleted.getContents().count(row) == 0) {
+                        deleted.addTuple(row);
+                        rowsOfRelation(nextDeltas, head).addTuple(row);
+                    }
+                }
+            }
+            
+            deltas = nextDeltas;
+        }
+    }
+    
+    for (const auto& rows : overDeleted) {
+        Relation* relation = database->relationWithName(rows.first);
+        for (const Tuple& row : rows.second.getContents()) {
+            removeRow(relation, row);
+        }
+    }
+    
+    // Put back what can still be derived, one component at a time, so that each reads what those before it put back.
+    for (size_t component = 0; component < components.size(); component += 1) {
+        std::map<std::string, Relation> restored = std::map<std::string, Relation>();
+        
+        for (auto ruleIndex : components.at(component)) {
+            Relation* head = headRelations.at(ruleIndex);
+            auto candidates = overDeleted.find(head->getName());
+            if (candidates == overDeleted.end()) {
+                continue;
+            }
+            
+            // Rows which are still facts stay, however they were derived.
+            const std::set<Tuple>& headFacts = facts[head->getName()];
+            for (const Tuple& row : candidates->second.getContents()) {
+                if (headFacts.count(row) != 0 && addRow(head, row)) {
+                    rowsOfRelation(restored, head).addTuple(row);
+                }
+            }
+            
+            Relation rederived = compiledRederivingRules.at(ruleIndex).derive(0, candidates->second, &indexes);
+            for (const Tuple& row : rederived.getContents()) {
+                if (addRow(head, row)) {
+                    rowsOfRelation(restored, head).addTuple(row);
+                }
+            }
+        }
+        
+        std::map<std::string, Relation> added = std::map<std::string, Relation>();
+        propagate(component, restored, added);
+    }
+    return deletedCount;
+}
+
+size_t IncrementalEvaluator::insertFacts(const std::vector<Predicate*>& insertedFacts) {
+    std::map<std::string, Relation> added = std::map<std::string, Relation>();
+    size_t insertedCount = 0;
+    for (auto fact : insertedFacts) {
+        Relation* relation = database->relationWithName(fact->getIdentifier());
+        Tuple row = Tuple(fact->getItems());
+        if (relation == nullptr || row.size() != relation->getColumnCount()) {
+            continue;
+        }
+        
+        if (facts[relation->getName()].insert(row).second) {
+            insertedCount += 1;
+        }
+        if (addRow(relation, row)) {
+            rowsOfRelation(added, relation).addTuple(row);
+        }
+    }
+    
+    // Each component reads what was added before it, including what earlier components derived.
+    for (size_t component = 0; component < components.size() && !added.empty(); component += 1) {
+        propagate(component, rowsReadBy(component, added), added);
+    }
+    return insertedCount;
+}
+
+std::string IncrementalEvaluator::recompute() {
+    for (auto relation : database->getRelations()) {
+        *relation = Relation(relation->getName(), relation->getScheme());
+        for (const Tuple& row : facts[relation->getName()]) {
+            relation->addTuple(row);
+        }
+    }
+    
+    std::string trace = evaluateRules(database, program, true);
+    if (canMaintain()) {
+        // The rows we indexed are gone.
+        indexRelations();
+    }
+    return trace;
+}
+
+size_t IncrementalEvaluator::update(const std::vector<Predicate*>& insertedFacts, const std::vector<Predicate*>& deletedFacts) {
+    if (canMaintain()) {
+        size_t changedCount = deleteFacts(deletedFacts);
+        return changedCount + insertFacts(insertedFacts);
+    }
+    
+    size_t changedCount = 0;
+    for (auto fact : deletedFacts) {
+        changedCount += facts[fact->getIdentifier()].erase(Tuple(fact->getItems()));
+    }
+    for (auto fact : insertedFacts) {
+        Relation* relation = database->relationWithName(fact->getIdentifier());
+        if (relation != nullptr && fact->getItems().size() == relation->getColumnCount()
+            && facts[relation->getName()].insert(Tuple(fact->getItems())).second) {
+            changedCount += 1;
+        }
+    }
+    recompute();
+    return changedCount;
+}
@@ -0,0 +1,102 @@
+//
+//  IncrementalEvaluator.h
+//  LexerV1
+//
+//  Created by James Robinson on 12/27/19.
+//
+
+#ifndef IncrementalEvaluator_h
+#define IncrementalEvaluator_h
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include "Database.h"
+#include "DatalogProgram.h"
+#include "CompiledProgram.h"
+
+/// Keeps the relations a program derives up to date as facts are added to and removed from its database, without evaluating
+/// its rules again from scratch.
+///
+/// Insertions are propagated semi-naively. Deletions are handled by deleting and rederiving: first everything a deleted fact
+/// helped derive is removed, then whatever can still be derived from what is left is put back. Each runs through the
+/// program's strongly-connected components in the order @c evaluateRules evaluates them, and reads only the rows which
+/// changed, through indexes kept up to date alongside the relations.
+class IncrementalEvaluator {
+private:
+    DatalogProgram* program;
+    Database* database;
+    
+    /// Why the database can't be kept up to date incrementally, or empty if it can. If it can't, each update evaluates the
+    /// rules again from scratch.
+    std::string unsupportedReason;
+    
+    std::vector<CompiledRule> compiledRules;
+    std::vector<Relation*> headRelations;
+    /// For each rule, a copy whose body first reads its own head, which finds those of a set of rows it still derives.
+    std::vector<Rule*> rederivingRules;
+    std::vector<CompiledRule> compiledRederivingRules;
+    
+    /// The positions of the rules in each strongly-connected component, in the order they are evaluated.
+    std::vector<std::vector<size_t>> components;
+    /// The relations each component's rules read.
+    std::vector<std::set<std::string>> componentReads;
+    
+    MaintainedIndexes indexes;
+    
+    /// The rows given as facts for each relation, as opposed to those derived. Relations no rule derives hold only facts, so
+    /// their rows are taken as they stand, including any loaded from files.
+    std::map<std::string, std::set<Tuple>> facts;
+    
+    /// Builds the indexes the rules' delta plans look up, over the relations as they stand.
+    void indexRelations();
+    
+    /// Adds @c row to @c relation and its indexes.
+    ///
+    /// @returns @c true if the relation didn't already hold it.
+    bool addRow(Relation* relation, const Tuple& row);
+    
+    /// Removes @c row from @c relation and its indexes.
+    void removeRow(Relation* relation, const Tuple& row);
+    
+    /// Returns those of @c rows which the rules of @c component read.
+    std::map<std::string, Relation> rowsReadBy(size_t component, const std::map<std::string, Relation>& rows) const;
+    
+    /// Adds what the rules of @c component derive from @c deltas, then what they derive from those rows, until they derive
+    /// nothing new.
+    ///
+    /// @param added Receives every row added.
+    void propagate(size_t component, std::map<std::string, Relation> deltas, std::map<std::string, Relation>& added);
+    
+    /// @returns The number of facts which were held, and so removed.
+    size_t deleteFacts(const std::vector<Predicate*>& deletedFacts);
+    /// @returns The number of facts which weren't already held, and so added.
+    size_t insertFacts(const std::vector<Predicate*>& insertedFacts);
+    
+public:
+    /// @param database The database of @c program, already holding what evaluating its rules derives.
+    IncrementalEvaluator(DatalogProgram* program, Database* database);
+    ~IncrementalEvaluator();
+    
+    /// Returns @c true if updates are applied incrementally. Programs with rules which could not be compiled, or which
+    /// derive rows that don't fit their head relations, are evaluated from scratch instead.
+    bool canMaintain() const;
+    
+    std::string getUnsupportedReason() const;
+    
+    /// Removes @c deletedFacts, then adds @c insertedFacts, and brings every derived relation up to date. Afterward the
+    /// database holds exactly what evaluating the program's rules over the new facts would.
+    ///
+    /// Facts for relations the database doesn't hold, or which don't fit them, are ignored, as when facts are first loaded.
+    ///
+    /// @returns The number of facts actually removed or added, leaving out those which were already absent or present.
+    size_t update(const std::vector<Predicate*>& insertedFacts, const std::vector<Predicate*>& deletedFacts);
+    
+    /// Empties every relation, adds back its facts, and evaluates the rules from scratch.
+    ///
+    /// @returns The trace @c evaluateRules prints.
+    std::string recompute();
+};
+
+#endif /* IncrementalEvaluator_h */
@@ -17,7 +17,7 @@
 #include "Recognizers.h"
 
 /// Parses tokens in the open @c file stream.
-inline std::vector<Token*> collectedTokensFromFile(std::ifstream& file) {
+inline std::vector<Token*> collectedTokensFromFile(std::istream& file) {
     std::vector<Token*> tokens = std::vector<Token*>();
     
     // Parse tokens from stream
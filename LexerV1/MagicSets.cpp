@@ -0,0 +1,342 @@
+//
+//  MagicSets.cpp
+//  LexerV1
+//
+//  Created by James Robinson on 12/22/19.
+//
+
+#include "MagicSets.h"
+#include <map>
+#include <algorithm>
+#include <set>
+#include <vector>
+#include "Database.h"
+#include "EvaluatingDatabases.h"
+#include "CompiledProgram.h"
+
+std::string adornedRelationName(const std::string& relationName, const std::string& adornment) {
+    // Datalog identifiers can't hold an underscore, so these never clash with the program's own relations.
+    return relationName + "_" + adornment;
+}
+
+std::string magicRelationName(const std::string& relationName, const std::string& adornment) {
+    return "magic_" + relationName + "_" + adornment;
+}
+
+bool isConstantItem(const std::string& item) {
+    return !item.empty() && item.at(0) == '\'';
+}
+
+/// What rewriting a program has found and built so far.
+struct MagicSetsRewrite {
+    Database* database;
+    std::map<std::string, std::vector<Rule*>> rulesByHead;
+    
+    /// Each derived relation and binding pattern asked for, in the order they were first asked for.
+    std::vector<std::pair<std::string, std::string>> adornments = {};
+    std::set<std::pair<std::string, std::string>> adornmentsSeen = {};
+    /// Derived relations which must be evaluated in full, because something reads them without binding any column.
+    std::set<std::string> fullRelations = {};
+    
+    std::vector<Rule*> rules = {};
+    
+    MagicSetsRewrite(Database* database) {
+        this->database = database;
+    }
+    
+    bool isDerived(const std::string& relationName) const {
+        return rulesByHead.find(relationName) != rulesByHead.end();
+    }
+    
+    void askFor(const std::string& relationName, const std::string& adornment) {
+        auto adorned = std::make_pair(relationName, adornment);
+        if (adornmentsSeen.insert(adorned).second) {
+            adornments.push_back(adorned);
+        }
+    }
+    
+    /// Adds the copy of @c rule which derives only what a caller binding its head to @c adornment asks for, and the rules
+    /// which pass the values it binds on to the derived relations in its body.
+    void addAdornedRule(Rule* rule, const std::string& adornment);
+    
+    /// Adds the rule which copies the facts of @c relationName a caller binding it to @c adornment asks for.
+    void addAdornedFacts(const std::string& relationName, const std::string& adornment);
+    
+    /// Adds every relation the rules of the full relations read to them, and so on until there are no more.
+    void closeFullRelations();
+};
+
+void MagicSetsRewrite::addAdornedRule(Rule* rule, const std::string& adornment) {
+    Predicate* head = rule->getHeadPredicate();
+    std::vector<std::string> headItems = head->getItems();
+    
+    // The head's bound columns are what the magic relation holds.
+    std::set<std::string> boundVariables = std::set<std::string>();
+    Predicate* guard = new Predicate(RULES, magicRelationName(head->getIdentifier(), adornment));
+    for (size_t i = 0; i < headItems.size(); i += 1) {
+        if (adornment.at(i) == 'b') {
+            guard->addItem(headItems.at(i));
+            boundVariables.insert(headItems.at(i));
+        }
+    }
+    
+    std::vector<Predicate*> body = { guard };
+    for (auto predicate : rule->getPredicates()) {
+        std::string relationName = predicate->getIdentifier();
+        std::vector<std::string> items = predicate->getItems();
+        
+        if (!isDerived(relationName) || fullRelations.count(relationName) != 0) {
+            body.push_back(predicate);
+            boundVariables.insert(items.begin(), items.end());
+            continue;
+        }
+        
+        // Bind each variable the predicates before this one bound, the first time it appears.
+        std::string bodyAdornment = "";
+        std::vector<std::string> boundItems = {};
+        for (size_t i = 0; i < items.size(); i += 1) {
+            std::string item = items.at(i);
+            bool isRepeated = std::find(items.begin(), items.begin() + i, item) != items.begin() + i;
+            
+            if (!isConstantItem(item) && !isRepeated && boundVariables.count(item) != 0) {
+                bodyAdornment += "b";
+                boundItems.push_back(item);
+            } else {
+                bodyAdornment += "f";
+            }
+        }
+        
+        if (boundItems.empty()) {
+            // Nothing narrows what this predicate reads, so its relation is needed in full.
+            fullRelations.insert(relationName);
+            body.push_back(predicate);
+            boundVariables.insert(items.begin(), items.end());
+            continue;
+        }
+        
+        // A rule passing on just what its own magic relation holds would add nothing to it, so leave that one out.
+        std::string magicName = magicRelationName(relationName, bodyAdornment);
+        bool isPassedOn = false;
+        for (auto bodyPredicate : body) {
+            isPassedOn = isPassedOn || (bodyPredicate->getIdentifier() == magicName && bodyPredicate->getItems() == boundItems);
+        }
+        if (!isPassedOn) {
+            Predicate* magicHead = new Predicate(UNDEFINED, magicName);
+            magicHead->setItems(boundItems);
+            Rule* magicRule = new Rule();
+            magicRule->setHeadPredicate(magicHead);
+            magicRule->setPredicates(body);
+            rules.push_back(magicRule);
+        }
+        askFor(relationName, bodyAdornment);
+        
+        Predicate* adornedPredicate = new Predicate(RULES, adornedRelationName(relationName, bodyAdornment));
+        adornedPredicate->setItems(items);
+        body.push_back(adornedPredicate);
+        boundVariables.insert(items.begin(), items.end());
+    }
+    
+    Predicate* adornedHead = new Predicate(head->getType(), adornedRelationName(head->getIdentifier(), adornment));
+    adornedHead->setItems(headItems);
+    Rule* adornedRule = new Rule();
+    adornedRule->setHeadPredicate(adornedHead);
+    adornedRule->setPredicates(body);
+    rules.push_back(adornedRule);
+}
+
+void MagicSetsRewrite::addAdornedFacts(const std::string& relationName, const std::string& adornment) {
+    Relation* relation = database->relationWithName(relationName);
+    
+    Predicate* head = new Predicate(UNDEFINED, adornedRelationName(relationName, adornment));
+    Predicate* guard = new Predicate(RULES, magicRelationName(relationName, adornment));
+    Predicate* source = new Predicate(RULES, relationName);
+    for (size_t i = 0; i < relation->getColumnCount(); i += 1) {
+        std::string variable = "x_" + std::to_string(i);
+        head->addItem(variable);
+        source->addItem(variable);
+        if (adornment.at(i) == 'b') {
+            guard->addItem(variable);
+        }
+    }
+    
+    Rule* rule = new Rule();
+    rule->setHeadPredicate(head);
+    rule->addPredicate(guard);
+    rule->addPredicate(source);
+    rules.push_back(rule);
+}
+
+void MagicSetsRewrite::closeFullRelations() {
+    std::vector<std::string> unvisited = std::vector<std::string>(fullRelations.begin(), fullRelations.end());
+    
+    while (!unvisited.empty()) {
+        std::string relationName = unvisited.back();
+        unvisited.pop_back();
+        
+        for (auto rule : rulesByHead.at(relationName)) {
+            for (auto predicate : rule->getPredicates()) {
+                std::string bodyName = predicate->getIdentifier();
+                if (isDerived(bodyName) && fullRelations.insert(bodyName).second) {
+                    unvisited.push_back(bodyName);
+                }
+            }
+        }
+    }
+}
+
+DatalogProgram* magicSetsProgram(DatalogProgram* program) {
+    Database* database = new Database();
+    evaluateSchemes(database, program);
+    MagicSetsRewrite rewrite = MagicSetsRewrite(database);
+    
+    // Rewriting keeps what each rule derives, so leave alone programs whose rules behave in ways it would change.
+    for (auto rule : program->getRules()) {
+        CompiledRule compiled = CompiledRule(rule, database);
+        bool readsEveryRelation = true;
+        for (auto predicate : rule->getPredicates()) {
+            readsEveryRelation = readsEveryRelation && database->relationWithName(predicate->getIdentifier()) != nullptr;
+        }
+        
+        if (!compiled.isUnionCompatible() || !readsEveryRelation) {
+            delete database;
+            return nullptr;
+        }
+        
+        rewrite.rulesByHead[rule->getHeadPredicate()->getIdentifier()].push_back(rule);
+    }
+    
+    // Seed a magic relation with the constants each query binds.
+    std::vector<Predicate*> seeds = std::vector<Predicate*>();
+    std::vector<std::pair<std::string, std::string>> queried = {};
+    for (auto query : program->getQueries()) {
+        std::string relationName = query->getIdentifier();
+        if (!rewrite.isDerived(relationName)) {
+            continue;
+        }
+        
+        std::string adornment = "";
+        std::vector<std::string> constants = {};
+        for (auto item : query->getItems()) {
+            adornment += isConstantItem(item) ? "b" : "f";
+            if (isConstantItem(item)) {
+                constants.push_back(item);
+            }
+        }
+        
+        if (constants.empty() || !CompiledQuery(query, database).isCompiled()) {
+            rewrite.fullRelations.insert(relationName);
+            continue;
+        }
+        
+        Predicate* seed = new Predicate(FACTS, magicRelationName(relationName, adornment));
+        seed->setItems(constants);
+        seeds.push_back(seed);
+        if (rewrite.adornmentsSeen.count(std::make_pair(relationName, adornment)) == 0) {
+            queried.push_back(std::make_pair(relationName, adornment));
+        }
+        rewrite.askFor(relationName, adornment);
+    }
+    
+    if (rewrite.adornments.empty()) {
+        for (auto seed : seeds) {
+            delete seed;
+        }
+        delete database;
+        return nullptr;
+    }
+    
+    // Rewrite the rules for each binding pattern, including those the rewritten rules ask for in turn.
+    std::set<std::string> relationsWithFacts = std::set<std::string>();
+    for (auto fact : program->getFacts()) {
+        relationsWithFacts.insert(fact->getIdentifier());
+    }
+    for (size_t i = 0; i < rewrite.adornments.size(); i += 1) {
+        std::string relationName = rewrite.adornments.at(i).first;
+        std::string adornment = rewrite.adornments.at(i).second;
+        
+        for (auto rule : rewrite.rulesByHead.at(relationName)) {
+            rewrite.addAdornedRule(rule, adornment);
+        }
+        if (relationsWithFacts.count(relationName) != 0) {
+            rewrite.addAdornedFacts(relationName, adornment);
+        }
+    }
+    rewrite.closeFullRelations();
+    
+    // Add what the queries asked for back to the relations they read.
+    for (const auto& adorned : queried) {
+        if (rewrite.fullRelations.count(adorned.first) != 0) {
+            continue;
+        }
+        
+        Predicate* head = new Predicate(UNDEFINED, adorned.first);
+        Predicate* source = new Predicate(RULES, adornedRelationName(adorned.first, adorned.second));
+        for (size_t i = 0; i < adorned.second.size(); i += 1) {
+            head->addItem("x_" + std::to_string(i));
+            source->addItem("x_" + std::to_string(i));
+        }
+        
+        Rule* rule = new Rule();
+        rule->setHeadPredicate(head);
+        rule->addPredicate(source);
+        rewrite.rules.push_back(rule);
+    }
+    
+    DatalogProgram* result = new DatalogProgram(program->getIdentifier());
+    
+    for (auto scheme : program->getSchemes()) {
+        result->addScheme(scheme);
+    }
+    for (const auto& adorned : rewrite.adornments) {
+        Tuple columns = database->relationWithName(adorned.first)->getScheme();
+        Predicate* adornedScheme = new Predicate(SCHEMES, adornedRelationName(adorned.first, adorned.second));
+        Predicate* magicScheme = new Predicate(SCHEMES, magicRelationName(adorned.first, adorned.second));
+        for (size_t i = 0; i < columns.size(); i += 1) {
+            adornedScheme->addItem(columns.at(i));
+            if (adorned.second.at(i) == 'b') {
+                magicScheme->addItem(columns.at(i));
+            }
+        }
+        result->addScheme(adornedScheme);
+        result->addScheme(magicScheme);
+    }
+    
+    for (auto fact : program->getFacts()) {
+        result->addFact(fact);
+    }
+    for (auto seed : seeds) {
+        result->addFact(seed);
+    }
+    
+    // Relations needed in full keep their own rules.
+    for (auto rule : program->getRules()) {
+        if (rewrite.fullRelations.count(rule->getHeadPredicate()->getIdentifier()) != 0) {
+            result->addRule(rule);
+        }
+    }
+    for (auto rule : rewrite.rules) {
+        result->addRule(rule);
+    }
+    
+    for (auto query : program->getQueries()) {
+        result->addQuery(query);
+    }
+    
+    delete database;
+    
+    // Make sure every rule we wrote fits the relation it writes.
+    Database* rewrittenDatabase = new Database();
+    evaluateSchemes(rewrittenDatabase, result);
+    bool isCompatible = true;
+    for (auto rule : rewrite.rules) {
+        isCompatible = isCompatible && CompiledRule(rule, rewrittenDatabase).isUnionCompatible();
+    }
+    delete rewrittenDatabase;
+    
+    if (!isCompatible) {
+        delete result;
+        return nullptr;
+    }
+    
+    return result;
+}
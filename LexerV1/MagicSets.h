@@ -0,0 +1,35 @@
+//
+//  MagicSets.h
+//  LexerV1
+//
+//  Created by James Robinson on 12/22/19.
+//
+
+#ifndef MagicSets_h
+#define MagicSets_h
+
+#include <string>
+#include "DatalogProgram.h"
+
+/// Returns the name of the relation holding the rows of @c relationName which a caller binding the columns marked @c 'b' in
+/// @c adornment asks for.
+std::string adornedRelationName(const std::string& relationName, const std::string& adornment);
+
+/// Returns the name of the relation holding the values a caller binds the columns marked @c 'b' in @c adornment to.
+std::string magicRelationName(const std::string& relationName, const std::string& adornment);
+
+/// Rewrites @c program so that evaluating it derives only the rows its queries can ask for.
+///
+/// Each query giving constants for a derived relation seeds a magic relation with them. Each rule for that relation is then
+/// copied once per binding pattern it is asked with, guarded by the magic relation, and passes the values it binds on to
+/// the derived relations in its body, from left to right. What the copies derive is added back to the queried relation,
+/// so the queries themselves run unchanged. Relations queried or read without any bound column keep their own rules.
+///
+/// The rewritten program retains the schemes, facts, queries and unchanged rules it shares with @c program, so either may be
+/// deleted first.
+///
+/// @returns The rewritten program, or @c nullptr if no query binds a derived relation, or if any rule could not be compiled
+/// or derives rows which don't fit its head relation, whose results rewriting could change.
+DatalogProgram* magicSetsProgram(DatalogProgram* program);
+
+#endif /* MagicSets_h */
@@ -0,0 +1,200 @@
+//
+//  OutputSink.cpp
+//  LexerV1
+//
+//  Created by James Robinson on 12/31/19.
+//
+
+#include "OutputSink.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cwctype>
+#include <unistd.h>
+
+// MARK: - OutputSink
+
+OutputSink::~OutputSink() {}
+
+void OutputSink::flush() {}
+
+void OutputSink::write(const std::string& text) {
+    write(text.data(), text.size());
+}
+
+void OutputSink::writeRow(const Relation& relation, const Tuple& tuple) {
+    rowLine.assign("  ");
+    relation.appendTuple(rowLine, tuple);
+    rowLine.push_back('\n');
+    write(rowLine);
+}
+
+OutputSink& OutputSink::operator <<(const std::string& text) {
+    write(text.data(), text.size());
+    return *this;
+}
+
+OutputSink& OutputSink::operator <<(const char* text) {
+    write(text, strlen(text));
+    return *this;
+}
+
+OutputSink& OutputSink::operator <<(char character) {
+    write(&character, 1);
+    return *this;
+}
+
+// MARK: - StringSink
+
+StringSink::StringSink() {
+    this->contents = "";
+}
+
+void StringSink::write(const char* data, size_t length) {
+    contents.append(data, length);
+}
+
+const std::string& StringSink::getContents() const {
+    return contents;
+}
+
+std::string StringSink::takeContents() {
+    std::string result = std::string();
+    result.swap(contents);
+    return result;
+}
+
+// MARK: - DiscardingSink
+
+void DiscardingSink::write(const char*, size_t) {}
+
+// MARK: - FileDescriptorSink
+
+FileDescriptorSink::FileDescriptorSink(int fileDescriptor, size_t bufferSize) {
+    this->fileDescriptor = fileDescriptor;
+    this->buffer = std::vector<char>(std::max(bufferSize, static_cast<size_t>(1)));
+    this->bufferedCount = 0;
+    this->didFail = false;
+}
+
+FileDescriptorSink::~FileDescriptorSink() {
+    flush();
+}
+
+void FileDescriptorSink::writeThrough(const char* data, size_t length) {
+    while (length > 0 && !didFail) {
+        ssize_t writtenCount = ::write(fileDescriptor, data, length);
+        if (writtenCount < 0 && errno == EINTR) {
+            continue;
+        }
+        if (writtenCount <= 0) {
+            didFail = true;
+            break;
+        }
+        data += writtenCount;
+        length -= static_cast<size_t>(writtenCount);
+    }
+}
+
+void FileDescriptorSink::write(const char* data, size_t length) {
+    if (bufferedCount + length > buffer.size()) {
+        flush();
+    }
+    
+    if (length >= buffer.size()) {
+        writeThrough(data, length);
+        return;
+    }
+    
+    memcpy(buffer.data() + bufferedCount, data, length);
+    bufferedCount += length;
+}
+
+void FileDescriptorSink::flush() {
+    writeThrough(buffer.data(), bufferedCount);
+    bufferedCount = 0;
+}
+
+bool FileDescriptorSink::hasFailed() const {
+    return didFail;
+}
+
+// MARK: - TrimmingSink
+
+TrimmingSink::TrimmingSink(OutputSink& destination): destination(destination) {
+    this->heldWhitespace = "";
+}
+
+void TrimmingSink::write(const char* data, size_t length) {
+    // Everything up to the last character which isn't whitespace goes out, after whatever whitespace came before it.
+    size_t end = length;
+    while (end > 0 && iswspace(data[end - 1])) {
+        end -= 1;
+    }
+    
+    if (end > 0) {
+        destination.write(heldWhitespace);
+        heldWhitespace.clear();
+        destination.write(data, end);
+    }
+    heldWhitespace.append(data + end, length - end);
+}
+
+void TrimmingSink::flush() {
+    destination.flush();
+}
+
+// MARK: - BinaryWriter
+
+BinaryWriter::BinaryWriter(OutputSink& output): output(output) {
+    this->offset = 0;
+}
+
+void BinaryWriter::writeBytes(const char* data, size_t length) {
+    output.write(data, length);
+    offset += length;
+}
+
+void BinaryWriter::writeInteger(uint64_t value, size_t width) {
+    char bytes[8];
+    for (size_t i = 0; i < width; i += 1) {
+        bytes[i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+    }
+    writeBytes(bytes, width);
+}
+
+void BinaryWriter::pad() {
+    static const char zeros[8] = {};
+    writeBytes(zeros, (8 - offset % 8) % 8);
+}
+
+void BinaryWriter::writeString(const std::string& text) {
+    writeInteger(text.size());
+    writeBytes(text.data(), text.size());
+    pad();
+}
+
+void BinaryWriter::writeCodes(const std::vector<uint32_t>& codes) {
+    std::vector<char> bytes = std::vector<char>(codes.size() * 4);
+    for (size_t i = 0; i < codes.size(); i += 1) {
+        for (size_t b = 0; b < 4; b += 1) {
+            bytes[i * 4 + b] = static_cast<char>((codes[i] >> (8 * b)) & 0xFF);
+        }
+    }
+    writeBytes(bytes.data(), bytes.size());
+    pad();
+}
+
+void BinaryWriter::writeSymbols(const std::vector<std::string>& symbols) {
+    writeInteger(symbols.size());
+    uint64_t symbolOffset = 0;
+    writeInteger(symbolOffset);
+    for (const auto& symbol : symbols) {
+        symbolOffset += symbol.size();
+        writeInteger(symbolOffset);
+    }
+    for (const auto& symbol : symbols) {
+        writeBytes(symbol.data(), symbol.size());
+    }
+    pad();
+}
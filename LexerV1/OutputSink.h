@@ -0,0 +1,135 @@
+//
+//  OutputSink.h
+//  LexerV1
+//
+//  Created by James Robinson on 12/31/19.
+//
+
+#ifndef OutputSink_h
+#define OutputSink_h
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "Relation.h"
+
+/// Somewhere output goes as it's produced, so that a run needn't hold all of it at once.
+class OutputSink {
+private:
+    /// Reused by @c writeRow, so formatting a row needn't allocate.
+    std::string rowLine;
+    
+public:
+    virtual ~OutputSink();
+    
+    virtual void write(const char* data, size_t length) = 0;
+    
+    /// Passes on whatever is held back. A sink which holds nothing back needn't override this.
+    virtual void flush();
+    
+    void write(const std::string& text);
+    
+    /// Writes @c tuple as a line of a trace or an answer: indented, then each column of @c relation with its value.
+    void writeRow(const Relation& relation, const Tuple& tuple);
+    
+    OutputSink& operator <<(const std::string& text);
+    OutputSink& operator <<(const char* text);
+    OutputSink& operator <<(char character);
+};
+
+/// Gathers output into a string.
+class StringSink: public OutputSink {
+private:
+    std::string contents;
+    
+public:
+    StringSink();
+    
+    using OutputSink::write;
+    void write(const char* data, size_t length) override;
+    
+    const std::string& getContents() const;
+    
+    /// Returns what was written, leaving the sink empty.
+    std::string takeContents();
+};
+
+/// Drops everything written to it.
+class DiscardingSink: public OutputSink {
+public:
+    using OutputSink::write;
+    void write(const char* data, size_t length) override;
+};
+
+/// Writes output to a file descriptor, a buffer at a time.
+class FileDescriptorSink: public OutputSink {
+private:
+    int fileDescriptor;
+    std::vector<char> buffer;
+    size_t bufferedCount;
+    bool didFail;
+    
+    /// Writes all of @c data to the file descriptor, unless a write has already failed.
+    void writeThrough(const char* data, size_t length);
+    
+public:
+    /// @param bufferSize How much output to hold before writing it. Anything at least this long is written straight through.
+    FileDescriptorSink(int fileDescriptor, size_t bufferSize = 1 << 20);
+    
+    /// Flushes what remains. The file descriptor is left open.
+    ~FileDescriptorSink() override;
+    
+    using OutputSink::write;
+    void write(const char* data, size_t length) override;
+    void flush() override;
+    
+    /// Returns @c true if a write failed, after which output is dropped.
+    bool hasFailed() const;
+};
+
+/// Passes output on to another sink, holding back each run of whitespace until something else follows it, so that whatever
+/// whitespace ends the output is dropped.
+class TrimmingSink: public OutputSink {
+private:
+    OutputSink& destination;
+    std::string heldWhitespace;
+    
+public:
+    TrimmingSink(OutputSink& destination);
+    
+    using OutputSink::write;
+    void write(const char* data, size_t length) override;
+    
+    /// Flushes the destination. Whitespace held back stays held, since more output may yet follow it.
+    void flush() override;
+};
+
+/// Writes binary output to a sink, keeping count of the bytes written so that each part can be aligned.
+class BinaryWriter {
+private:
+    OutputSink& output;
+    size_t offset;
+    
+public:
+    BinaryWriter(OutputSink& output);
+    
+    void writeBytes(const char* data, size_t length);
+    
+    /// Writes @c value, little-endian, in @c width bytes.
+    void writeInteger(uint64_t value, size_t width = 8);
+    
+    /// Writes zeros up to the next multiple of 8 bytes.
+    void pad();
+    
+    /// Writes the length of @c text, then @c text, padded.
+    void writeString(const std::string& text);
+    
+    /// Writes @c codes as 32-bit integers, padded.
+    void writeCodes(const std::vector<uint32_t>& codes);
+    
+    /// Writes a symbol dictionary: the count of @c symbols, then that many plus one offsets into the bytes which follow,
+    /// padded. Symbol @c i spans from offset @c i up to offset @c i + 1.
+    void writeSymbols(const std::vector<std::string>& symbols);
+};
+
+#endif /* OutputSink_h */
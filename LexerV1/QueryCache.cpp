@@ -0,0 +1,136 @@
+//
+//  QueryCache.cpp
+//  LexerV1
+//
+//  Created by James Robinson on 12/30/19.
+//
+
+#include "QueryCache.h"
+#include <algorithm>
+
+QueryCache::QueryCache(size_t maximumRowCount) {
+    this->rowCount = 0;
+    this->maximumRowCount = maximumRowCount;
+    this->hitCount = 0;
+    this->subsumedHitCount = 0;
+    this->missCount = 0;
+}
+
+// MARK: - Patterns
+
+std::vector<std::string> QueryCache::patternOfQuery(Predicate* query) {
+    std::vector<std::string> items = query->getItems();
+    std::vector<std::string> pattern = std::vector<std::string>();
+    
+    for (size_t col = 0; col < items.size(); col += 1) {
+        if (items.at(col).at(0) == '\'') {
+            pattern.push_back(items.at(col));
+            continue;
+        }
+        
+        size_t first = static_cast<size_t>(std::find(items.begin(), items.end(), items.at(col)) - items.begin());
+        pattern.push_back("#" + std::to_string(first));
+    }
+    
+    return pattern;
+}
+
+bool QueryCache::subsumes(const std::vector<std::string>& general, const std::vector<std::string>& specific) {
+    if (general.size() != specific.size()) {
+        return false;
+    }
+    
+    for (size_t col = 0; col < general.size(); col += 1) {
+        const std::string& item = general.at(col);
+        
+        // A constant must be asked for again.
+        if (item.at(0) == '\'' && specific.at(col) != item) {
+            return false;
+        }
+        
+        // A repeated variable needs the same value in both its columns, as it has if they read the same in the specific
+        // pattern, being the same constant or the same variable.
+        if (item.at(0) == '#') {
+            size_t first = static_cast<size_t>(std::stoul(item.substr(1)));
+            if (first != col && specific.at(first) != specific.at(col)) {
+                return false;
+            }
+        }
+    }
+    
+    return true;
+}
+
+// MARK: - Answering
+
+std::string QueryCache::answer(const CompiledQuery& query) {
+    if (!query.isCompiled()) {
+        return query.evaluate();
+    }
+    
+    const Relation* relation = query.getRelation();
+    std::vector<std::string> pattern = patternOfQuery(query.getQuery());
+    
+    // Let go of what the relation held before it last changed, and find the fewest rows we could read instead.
+    auto best = entries.end();
+    for (auto entry = entries.begin(); entry != entries.end();) {
+        if (entry->relation != relation) {
+            ++entry;
+            continue;
+        }
+        
+        if (entry->version != relation->getVersion()) {
+            rowCount -= entry->rows->getContents().size();
+            entry = entries.erase(entry);
+            continue;
+        }
+        
+        if (subsumes(entry->pattern, pattern) &&
+            (best == entries.end() || entry->rows->getContents().size() < best->rows->getContents().size())) {
+            best = entry;
+        }
+        ++entry;
+    }
+    
+    if (best != entries.end()) {
+        hitCount += 1;
+        if (best->pattern != pattern) {
+            subsumedHitCount += 1;
+        }
+        return query.evaluate(best->rows.get());
+    }
+    
+    missCount += 1;
+    std::unique_ptr<Relation> rows = std::unique_ptr<Relation>(new Relation(query.matchingRows()));
+    entries.push_back(Entry{ relation, relation->getVersion(), pattern, std::move(rows) });
+    std::string result = query.evaluate(entries.back().rows.get());
+    
+    rowCount += entries.back().rows->getContents().size();
+    while (rowCount > maximumRowCount && !entries.empty()) {
+        rowCount -= entries.front().rows->getContents().size();
+        entries.pop_front();
+    }
+    
+    return result;
+}
+
+void QueryCache::clear() {
+    entries.clear();
+    rowCount = 0;
+}
+
+size_t QueryCache::getHitCount() const {
+    return hitCount;
+}
+
+size_t QueryCache::getSubsumedHitCount() const {
+    return subsumedHitCount;
+}
+
+size_t QueryCache::getMissCount() const {
+    return missCount;
+}
+
+size_t QueryCache::getEntryCount() const {
+    return entries.size();
+}
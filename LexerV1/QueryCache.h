@@ -0,0 +1,72 @@
+//
+//  QueryCache.h
+//  LexerV1
+//
+//  Created by James Robinson on 12/30/19.
+//
+
+#ifndef QueryCache_h
+#define QueryCache_h
+
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include "Relation.h"
+#include "CompiledProgram.h"
+
+/// Remembers the rows queries matched, so that asking again, or asking something more specific, reads only those rows
+/// rather than the whole relation.
+///
+/// Each entry is keyed by the relation it read, that relation's version, and the query's pattern: its constants, and which
+/// of its columns must hold the same value. A query is answered from an entry whose pattern matches every row its own
+/// does, so long as the relation hasn't changed since.
+class QueryCache {
+private:
+    struct Entry {
+        const Relation* relation;
+        size_t version;
+        std::vector<std::string> pattern;
+        /// The rows of the relation the pattern matched.
+        std::unique_ptr<Relation> rows;
+    };
+    
+    /// Oldest first, so the oldest are let go first when the cache holds too many rows.
+    std::list<Entry> entries;
+    size_t rowCount;
+    size_t maximumRowCount;
+    
+    size_t hitCount;
+    size_t subsumedHitCount;
+    size_t missCount;
+    
+    /// Returns the pattern of @c query: each constant as written, and each variable as @c #n, where @c n is the first column
+    /// it appears in.
+    static std::vector<std::string> patternOfQuery(Predicate* query);
+    
+    /// Returns @c true if every row matching @c specific also matches @c general.
+    static bool subsumes(const std::vector<std::string>& general, const std::vector<std::string>& specific);
+    
+public:
+    /// @param maximumRowCount How many rows the cache may hold in all before it lets go of its oldest entries.
+    QueryCache(size_t maximumRowCount = 1000000);
+    
+    /// Answers @c query as @c CompiledQuery::evaluate would, reading the rows of a cached query if one matches them all.
+    std::string answer(const CompiledQuery& query);
+    
+    /// Lets go of every entry.
+    void clear();
+    
+    /// Returns how many queries were answered from the cache, including those answered from a more general query.
+    size_t getHitCount() const;
+    
+    /// Returns how many of the hits were answered from a more general query than the one asked.
+    size_t getSubsumedHitCount() const;
+    
+    /// Returns how many queries read their relation.
+    size_t getMissCount() const;
+    
+    size_t getEntryCount() const;
+};
+
+#endif /* QueryCache_h */
@@ -7,29 +7,50 @@
 //
 
 #include "Relation.h"
+#include <algorithm>
+#include <iterator>
+#include <unordered_map>
+#include <atomic>
+#include "ThreadPool.h"
+
+/// The version the next change to any relation gives it.
+static std::atomic<size_t> nextVersion(1);
 
 Relation::Relation(const Relation &other) {
     this->name = other.name;
     this->contents = std::set<Tuple>(other.contents);
     this->scheme = Tuple(other.scheme);
+    noteChange();
 }
 
 Relation::Relation(const std::string name, Tuple scheme) {
     this->name = name;
     this->contents = std::set<Tuple>();
     this->scheme = scheme;
+    noteChange();
 }
 
 Relation::~Relation() {
     contents.clear();
 }
 
+Relation& Relation::operator =(const Relation &other) {
+    if (this != &other) {
+        this->name = other.name;
+        this->contents = std::set<Tuple>(other.contents);
+        this->scheme = Tuple(other.scheme);
+        noteChange();
+    }
+    return *this;
+}
+
 std::string Relation::getName() const {
     return this->name;
 }
 
 void Relation::setName(const std::string &newName) {
     this->name = newName;
+    noteChange();
 }
 
 size_t Relation::getColumnCount() const {
@@ -40,12 +61,48 @@ const Tuple& Relation::getScheme() const {
     return scheme;
 }
 
+size_t Relation::getVersion() const {
+    return version;
+}
+
+void Relation::noteChange() {
+    version = nextVersion.fetch_add(1, std::memory_order_relaxed);
+}
+
 bool Relation::addTuple(Tuple element) {
     if (element.size() != getColumnCount()) {
         return false;
     }
     
-    this->contents.insert(element);
+    if (this->contents.insert(element).second) {
+        noteChange();
+    }
+    return true;
+}
+
+size_t Relation::addTuples(std::vector<Tuple> &rows) {
+    size_t previousCount = contents.size();
+    
+    auto hint = contents.end();
+    for (auto& row : rows) {
+        if (row.size() == getColumnCount()) {
+            hint = std::next(contents.insert(hint, std::move(row)));
+        }
+    }
+    
+    size_t addedCount = contents.size() - previousCount;
+    if (addedCount > 0) {
+        noteChange();
+    }
+    return addedCount;
+}
+
+bool Relation::removeTuple(const Tuple& element) {
+    if (this->contents.erase(element) == 0) {
+        return false;
+    }
+    
+    noteChange();
     return true;
 }
 
@@ -66,6 +123,7 @@ const std::vector<Tuple> Relation::listContents() const {
 // MARK: - Rename
 
 void Relation::rename(const std::string& oldCol, const std::string& newCol) {
+    noteChange();
     Tuple newScheme = getScheme();
     std::set<std::string> newSchemeContents = std::set<std::string>();
     
@@ -86,6 +144,7 @@ void Relation::rename(const std::string& oldCol, const std::string& newCol) {
 }
 
 void Relation::rename(const Tuple& newScheme) {
+    noteChange();
     if (newScheme.size() != getScheme().size() || // Wrong size, or
         newScheme == getScheme()) { // Identical scheme
         return;
@@ -128,31 +187,37 @@ Relation Relation::renamed(const Tuple& newScheme) const {
 // MARK: - Select
 
 void Relation::select(const std::vector< std::pair<size_t, std::string> >& queries) {
-    std::set<Tuple> result = std::set<Tuple>();
+    noteChange();
     
-    // Evaluate each tuple
-    for (auto t : getContents()) {
+    // Only queries in range take part.
+    std::vector< std::pair<size_t, const std::string*> > checks = {};
+    for (const auto& query : queries) {
+        if (query.first < getColumnCount()) {
+            checks.push_back(std::make_pair(query.first, &query.second));
+        }
+    }
+    
+    if (checks.empty()) {
+        return; // Nothing to check? Keep everything.
+    }
+    
+    // Evaluate each tuple, dropping it where it stands if it doesn't match.
+    for (auto t = contents.begin(); t != contents.end();) {
         bool isMatch = true;
         
-        for (auto query : queries) {
-            size_t col = query.first;
-            std::string val = query.second;
-            
-            if (col >= getColumnCount()) {
-                continue; // Too big? Next query.
-            }
-            if (t.at(col) != val) {
+        for (const auto& check : checks) {
+            if ((*t)[check.first] != *check.second) {
                 isMatch = false;
                 break; // Column doesn't match an expected value? Next tuple.
             }
         }
         
         if (isMatch) {
-            result.insert(t);
+            ++t;
+        } else {
+            t = contents.erase(t);
         }
     }
-    
-    this->contents = result;
 }
 
 Relation Relation::selecting(const std::vector< std::pair<size_t, std::string> >& queries) const {
@@ -162,44 +227,48 @@ Relation Relation::selecting(const std::vector< std::pair<size_t, std::string> >
 }
 
 void Relation::select(const std::vector<std::vector<size_t>>& queries) {
-//    Relation result = Relation(getName(), getScheme());
-    std::set<Tuple> result = std::set<Tuple>();
+    noteChange();
     
-    // Evaluate each equivalence
-    for (std::vector<size_t> query : queries) {
-        
+    // Only columns in range take part.
+    std::vector<std::vector<size_t>> checks = {};
+    for (const auto& query : queries) {
         if (query.empty()) { // No query? Select everything.
-            return; // Too hasty? Should we evaluate the rest first?
+            return;
         }
         
-        // Make sure that each of the named columns carry the same value, if they're in range.
-        for (auto t : getContents()) {
-            bool hasMatch = true;
-            std::string val = "LexerV1.INVALID";
-            
-            for (auto col : query) {
-                if (col >= getColumnCount()) {
-                    continue; // Too big? Move along.
-                }
-                
-                if (val == "LexerV1.INVALID") {
-                    val = t.at(col);
-                }
-                
-                // If we don't have a match, skip along.
-                if (t.at(col) != val) {
-                    hasMatch = false;
-                    break;
-                }
+        std::vector<size_t> cols = {};
+        for (auto col : query) {
+            if (col < getColumnCount()) {
+                cols.push_back(col);
+            }
+        }
+        if (cols.size() < 2) {
+            return; // Nothing to compare? Every tuple matches this query, so keep everything.
+        }
+        checks.push_back(cols);
+    }
+    
+    // A tuple stays if the named columns of any one query carry the same value, and is dropped where it stands if not.
+    for (auto t = contents.begin(); t != contents.end();) {
+        bool hasMatch = false;
+        
+        for (const auto& cols : checks) {
+            const std::string& val = (*t)[cols.front()];
+            hasMatch = true;
+            for (size_t i = 1; i < cols.size() && hasMatch; i += 1) {
+                hasMatch = (*t)[cols.at(i)] == val;
             }
-            
             if (hasMatch) {
-                result.insert(t);
+                break;
             }
         }
+        
+        if (hasMatch) {
+            ++t;
+        } else {
+            t = contents.erase(t);
+        }
     }
-    
-    this->contents = result;
 }
 
 Relation Relation::selecting(const std::vector< std::vector<size_t> >& queries) const {
@@ -267,6 +336,8 @@ int Relation::indexForColumnInTuple(std::string col, const Tuple &domain) const
 }
 
 void Relation::swapColumns(size_t oldCol, size_t newCol) {
+    noteChange();
+    
     if (getScheme().empty()) {
         return; // Empty scheme? Done.
     }
@@ -299,48 +370,61 @@ void Relation::swapColumns(size_t oldCol, size_t newCol) {
     contents = reordered;
 }
 
-void Relation::keepOnlyColumnsUntil(size_t col) {
-    if (col >= getColumnCount()) {
-        return;
+void Relation::project(const Tuple& scheme) {
+    if (scheme == getScheme()) {
+        return; // Same scheme? Return.
     }
     
-    // Strip from scheme
-    scheme.erase(scheme.begin() + col, scheme.end());
+    Tuple newScheme = scheme;
     
-    std::set<Tuple> stripped = std::set<Tuple>();
-    for (auto t : contents) {
-        
-        // Strip from each column
-        t.erase(t.begin() + col, t.end());
-        stripped.insert(t);
-        
-    }
+    stripExtraColsFromScheme(newScheme); // This removes columns that don't exist.
     
-    // If we only have a single empty row, remove it
-    if (stripped.size() == 1 && (*stripped.begin()).empty()) {
-        stripped.clear();
+    // For each column in scheme, find where it was in our old scheme.
+    std::vector<size_t> columns = std::vector<size_t>();
+    for (auto col : newScheme) {
+        columns.push_back(static_cast<size_t>(indexForColumnInScheme(col)));
     }
     
-    contents = stripped;
+    this->projectColumns(columns);
 }
 
-void Relation::project(const Tuple& scheme) {
-    if (scheme == getScheme()) {
-        return; // Same scheme? Return.
-    }
+void Relation::projectColumns(const std::vector<size_t>& columns) {
+    noteChange();
     
-    Tuple current = getScheme();
-    Tuple newScheme = scheme;
+    Tuple newScheme = Tuple();
+    for (auto col : columns) {
+        if (col >= getColumnCount()) {
+            return; // Column out of range? Don't touch anything.
+        }
+        newScheme.push_back(scheme.at(col));
+    }
     
-    stripExtraColsFromScheme(newScheme); // This removes columns that don't exist.
+    if (newScheme.empty()) {
+        // No columns means no rows.
+        scheme.clear();
+        contents.clear();
+        return;
+    }
     
-    // For each column in scheme, find where it was in our old scheme, then apply.
-    for (unsigned int newIndex = 0; newIndex < newScheme.size(); newIndex += 1) {
-        size_t oldIndex = indexForColumnInScheme(newScheme.at(newIndex));
-        this->swapColumns(oldIndex, newIndex);
+    // Emit each row in its new order, then sort and deduplicate them all at once.
+    std::vector<Tuple> rows = std::vector<Tuple>();
+    rows.reserve(contents.size());
+    for (const Tuple& t : contents) {
+        Tuple row = Tuple();
+        row.reserve(columns.size());
+        for (auto col : columns) {
+            row.push_back(t[col]);
+        }
+        rows.push_back(std::move(row));
     }
     
-    this->keepOnlyColumnsUntil(newScheme.size());
+    std::sort(rows.begin(), rows.end());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+    
+    // Sorted input lets the set build in linear time.
+    this->scheme = newScheme;
+    this->contents = std::set<Tuple>(std::make_move_iterator(rows.begin()),
+                                     std::make_move_iterator(rows.end()));
 }
 
 Relation Relation::projecting(const Tuple& scheme) const {
@@ -356,19 +440,43 @@ std::string Relation::stringForTuple(const Tuple& tuple) const {
         return ""; // Tuple couldn't be one of ours? Empty string.
     }
     
-    std::ostringstream result = std::ostringstream();
-    for (unsigned int i = 0; i < tuple.size(); i += 1) {
-        std::string col = getScheme().at(i);
-        std::string val = tuple.at(i);
-        
-        result << col << "=" << val;
-        if (i < getScheme().size() - 1) {
+    std::string result = std::string();
+    appendTuple(result, tuple);
+    return result;
+}
+
+void Relation::appendTuple(std::string& output, const Tuple& tuple) const {
+    if (tuple.size() != getColumnCount()) {
+        return;
+    }
+    
+    size_t length = output.size();
+    for (size_t i = 0; i < tuple.size(); i += 1) {
+        length += scheme.at(i).size() + 1 + tuple.at(i).size() + 2;
+    }
+    output.reserve(length);
+    
+    for (size_t i = 0; i < tuple.size(); i += 1) {
+        output.append(scheme.at(i));
+        output.push_back('=');
+        output.append(tuple.at(i));
+        if (i + 1 < tuple.size()) {
             // If more columns, add a comma
-            result << ", ";
+            output.append(", ");
         }
     }
-    
-    return result.str();
+}
+
+/// Rows per partition, chosen so that a partition's hash table stays within a core's cache.
+static const size_t JOIN_PARTITION_ROWS = 4096;
+
+/// Hashes the values of @c tuple found at each index in @c columns.
+static size_t hashForColumns(const Tuple& tuple, const std::vector<size_t>& columns) {
+    size_t result = 0;
+    for (auto col : columns) {
+        result ^= std::hash<std::string>()(tuple[col]) + 0x9e3779b97f4a7c15 + (result << 6) + (result >> 2);
+    }
+    return result;
 }
 
 Relation Relation::joinedWith(const Relation& other) const {
@@ -381,51 +489,153 @@ Relation Relation::joinedWith(const Relation& other) const {
     Tuple newScheme = getScheme().combinedWith(other.getScheme());
     Relation result = Relation(getName(), newScheme);
     
-    for (Tuple t1 : this->getContents()) {
-        for (Tuple t2 : other.getContents()) {
+    // Pair up the columns both relations share, and find which of the other's columns are new.
+    std::vector<size_t> keyCols = {};
+    std::vector<size_t> otherKeyCols = {};
+    std::vector<size_t> otherExtraCols = {};
+    for (size_t col = 0; col < other.getColumnCount(); col += 1) {
+        int index = this->indexForColumnInScheme(other.getScheme().at(col));
+        if (index >= 0) {
+            keyCols.push_back(static_cast<size_t>(index));
+            otherKeyCols.push_back(col);
+        } else {
+            otherExtraCols.push_back(col);
+        }
+    }
+    
+    // Split both sides by the hash of their join key, so that each partition can be joined on its own.
+    size_t rowCount = this->getContents().size() + other.getContents().size();
+    size_t partitionCount = 1;
+    while (partitionCount * JOIN_PARTITION_ROWS < rowCount) {
+        partitionCount <<= 1;
+    }
+    
+    std::vector<std::vector<std::pair<size_t, const Tuple*>>> partitions(partitionCount);
+    std::vector<std::vector<std::pair<size_t, const Tuple*>>> otherPartitions(partitionCount);
+    for (const Tuple& t : this->getContents()) {
+        size_t hash = hashForColumns(t, keyCols);
+        partitions[hash & (partitionCount - 1)].push_back(std::make_pair(hash, &t));
+    }
+    for (const Tuple& t : other.getContents()) {
+        size_t hash = hashForColumns(t, otherKeyCols);
+        otherPartitions[hash & (partitionCount - 1)].push_back(std::make_pair(hash, &t));
+    }
+    
+    // Join each partition: index the other side by hash, then probe with ours.
+    std::vector<std::vector<Tuple>> joinedPartitions(partitionCount);
+    auto joinPartition = [&](size_t p) {
+        std::unordered_multimap<size_t, const Tuple*> index = {};
+        index.reserve(otherPartitions[p].size());
+        for (const auto& entry : otherPartitions[p]) {
+            index.insert(entry);
+        }
+        
+        for (const auto& entry : partitions[p]) {
+            const Tuple& t1 = *entry.second;
+            auto matches = index.equal_range(entry.first);
             
-            Tuple combined = newScheme;
-            bool isValid = true;
-            for (size_t colIdx = 0; colIdx < combined.size(); colIdx += 1) {
-                // For each column,
-                std::string col = combined.at(colIdx);
+            for (auto match = matches.first; match != matches.second; ++match) {
+                const Tuple& t2 = *match->second;
                 
-                //   Find that item in each relation
-                int index1 = this->indexForColumnInScheme(col);
-                std::string val1 = "";
-                int index2 = other.indexForColumnInScheme(col);
-                std::string val2 = "";
-                
-                if (index1 >= 0) {
-                    val1 = t1.at(index1);
+                bool isValid = true;
+                for (size_t k = 0; k < keyCols.size() && isValid; k += 1) {
+                    isValid = t1[keyCols[k]] == t2[otherKeyCols[k]];
                 }
-                if (index2 >= 0) {
-                    val2 = t2.at(index2);
+                if (!isValid) {
+                    continue; // Hashes collided, but the values differ.
                 }
                 
-                if ((val1 == val2 && !val1.empty()) || // If val is identical, or
-                    (!val1.empty() && val2.empty())) { // If val is found only in t1,
-                    // Add t1's value to our combined tuple.
-                    combined.at(colIdx) = val1;
-                }
-                if ((val1 == val2 && !val2.empty()) || // If val is identical, or
-                    (!val2.empty() && val1.empty())) { // If val is found only in t2,
-                    // Add t2's value to our combined tuple.
-                    combined.at(colIdx) = val2;
-                }
-                if (val1 != val2 && !val1.empty() && !val2.empty()) { // If they're different,
-                    // Drop the tuple
-                    isValid = false;
+                Tuple combined = t1;
+                combined.reserve(newScheme.size());
+                for (auto col : otherExtraCols) {
+                    combined.push_back(t2[col]);
                 }
+                joinedPartitions[p].push_back(std::move(combined));
             }
+        }
+    };
+    
+    if (partitionCount > 1) {
+        ThreadPool::shared().parallelFor(partitionCount, joinPartition);
+    } else {
+        joinPartition(0);
+    }
+    
+    // Merge in partition order, so the work done is the same no matter how the threads ran.
+    for (auto& joined : joinedPartitions) {
+        for (auto& t : joined) {
+            result.contents.insert(std::move(t));
+        }
+    }
+    
+    return result;
+}
+
+JoinIndex Relation::joinIndexFor(const Tuple& otherScheme) const {
+    JoinIndex result = JoinIndex();
+    for (size_t col = 0; col < getColumnCount(); col += 1) {
+        if (indexForColumnInTuple(getScheme().at(col), otherScheme) >= 0) {
+            result.columns.push_back(col);
+        }
+    }
+    
+    result.rows.reserve(getContents().size());
+    for (const Tuple& t : getContents()) {
+        result.rows.insert(std::make_pair(hashForColumns(t, result.columns), &t));
+    }
+    
+    return result;
+}
+
+Relation Relation::joinedWith(const Relation& other, const JoinIndex& otherIndex) const {
+    if (this->getScheme() == other.getScheme() &&
+        this->getContents() == other.getContents()) {
+        return *this; // Identical scheme? Return self.
+    }
+    
+    Tuple newScheme = getScheme().combinedWith(other.getScheme());
+    Relation result = Relation(getName(), newScheme);
+    
+    // Line our columns up with the index's key, and find which of the other's columns are new.
+    std::vector<size_t> keyCols = {};
+    for (auto col : otherIndex.columns) {
+        keyCols.push_back(static_cast<size_t>(this->indexForColumnInScheme(other.getScheme().at(col))));
+    }
+    std::vector<size_t> otherExtraCols = {};
+    for (size_t col = 0; col < other.getColumnCount(); col += 1) {
+        if (this->indexForColumnInScheme(other.getScheme().at(col)) < 0) {
+            otherExtraCols.push_back(col);
+        }
+    }
+    
+    std::vector<Tuple> joined = {};
+    for (const Tuple& t1 : this->getContents()) {
+        auto matches = otherIndex.rows.equal_range(hashForColumns(t1, keyCols));
+        
+        for (auto match = matches.first; match != matches.second; ++match) {
+            const Tuple& t2 = *match->second;
             
-            if (isValid) {
-                result.addTuple(combined);
+            bool isValid = true;
+            for (size_t k = 0; k < keyCols.size() && isValid; k += 1) {
+                isValid = t1[keyCols[k]] == t2[otherIndex.columns[k]];
+            }
+            if (!isValid) {
+                continue; // Hashes collided, but the values differ.
             }
             
+            Tuple combined = t1;
+            combined.reserve(newScheme.size());
+            for (auto col : otherExtraCols) {
+                combined.push_back(t2[col]);
+            }
+            joined.push_back(std::move(combined));
         }
     }
     
+    for (auto& t : joined) {
+        result.contents.insert(std::move(t));
+    }
+    
     return result;
 }
 
@@ -447,6 +657,25 @@ Relation Relation::unionWith(const Relation& other) const {
     return result;
 }
 
+Relation Relation::insertAll(const Relation& other) {
+    Relation added = Relation(getName(), getScheme());
+    if (other.getScheme() != getScheme()) {
+        return added; // If we aren't union-compatible, add nothing.
+    }
+    
+    for (const Tuple& t : other.getContents()) {
+        if (this->contents.insert(t).second) {
+            // Rows arrive in order, so each new one goes on the end.
+            added.contents.insert(added.contents.end(), t);
+        }
+    }
+    if (!added.getContents().empty()) {
+        noteChange();
+    }
+    
+    return added;
+}
+
 bool Relation::operator ==(const Relation &other) {
     return (getName() == other.getName() &&
             getScheme() == other.getScheme() &&
@@ -13,13 +13,31 @@
 #include <set>
 #include <vector>
 #include <sstream>
+#include <unordered_map>
 #include "Tuple.h"
 
+/// A relation's rows, bucketed by the hash of the columns it shares with some other scheme.
+///
+/// Holds pointers into the indexed relation, so it is only valid while that relation is unchanged. Safe to probe from many
+/// threads at once.
+struct JoinIndex {
+    /// The indexed relation's key columns, in scheme order.
+    std::vector<size_t> columns;
+    std::unordered_multimap<size_t, const Tuple*> rows;
+};
+
+/// A named set of rows, each holding a value for every column of its scheme.
+///
+/// Its @c const members only read it, so many threads may call them at once, so long as none changes it meanwhile.
 class Relation {
 private:
     std::string name;
     Tuple scheme;
     std::set<Tuple> contents;
+    size_t version;
+    
+    /// Gives the relation a new version, after it changes.
+    void noteChange();
     
     /// Removes columns from @c otherScheme which are not found in the relation's scheme.
     ///
@@ -32,21 +50,36 @@ private:
     /// Returns the index of @c col in @c domain, or -1 if it is not found.
     int indexForColumnInTuple(std::string col, const Tuple &domain) const;
     
-    /// Strips all columns following @c col from the relation, including @c col.
-    void keepOnlyColumnsUntil(size_t col);
-    
 public:
     Relation(const Relation &other);
     Relation(const std::string name, Tuple scheme = Tuple());
     ~Relation();
     
+    /// Takes the name, scheme and rows of @c other. The relation gets a new version, since what it holds has changed.
+    Relation& operator =(const Relation &other);
+    
     std::string getName() const;
     void setName(const std::string& newName);
     const Tuple& getScheme() const;
     size_t getColumnCount() const;
     
+    /// Returns a number which changes whenever the relation does. No two states of any relations share a version, so a
+    /// relation showing the same version as before hasn't changed since.
+    size_t getVersion() const;
+    
     /// Adds the @c Tuple to the relation.  The tuple @b must contain exactly the number of elements specified in the relation.
     bool addTuple(Tuple element);
+    
+    /// Adds each of @c rows which fits the scheme, moving it out of @c rows. Sorted rows are added fastest, each being placed
+    /// after the one before.
+    ///
+    /// @returns How many rows were new.
+    size_t addTuples(std::vector<Tuple> &rows);
+    
+    /// Removes @c element from the relation.
+    ///
+    /// @returns @c true if the relation held it.
+    bool removeTuple(const Tuple& element);
     const std::set<Tuple>& getContents() const;
     const std::vector<Tuple> listContents() const;
     
@@ -86,10 +119,10 @@ public:
     
     /// Get rows whose values match each equivalence pair given in @c queries.
     ///
-    /// Each @c pair denotes two column indices. Each @c Tuple in the resulting @c Relation will contain matching values at both indices.
-    /// That is, the value at the first index matches the value at the second.
+    /// Each query lists column indices. Each @c Tuple in the resulting @c Relation will contain matching values at every index of at least
+    /// one query. That is, the value at the first index matches the value at the second, and so on.
     ///
-    /// A query is ignored if either column index is not valid for the relation's scheme.
+    /// A column index is ignored if it is not valid for the relation's scheme.
     ///
     /// @returns A new @c Relation whose rows match the query.
     Relation selecting(const std::vector<std::vector<size_t>>& queries) const;
@@ -104,6 +137,11 @@ public:
     /// Keeps in the receiver only the columns from the relation that correspond to the positions of the variables in the query.
     void project(const Tuple& otherScheme);
     
+    /// Keeps in the receiver only the columns at the given indices, in the given order, in a single pass over the rows.
+    ///
+    /// If any index is not valid for the relation's scheme, no change will occur.
+    void projectColumns(const std::vector<size_t>& columns);
+    
     /// Swaps the relation's scheme and values at index @c oldCol with @c newCol.
     ///
     /// If @c newCol exceeds the scheme's last index, swaps with the last column instead.
@@ -112,11 +150,29 @@ public:
     /// Performs a natural join to another relation.
     Relation joinedWith(const Relation &other) const;
     
+    /// Indexes the receiver's rows by the columns it shares with @c otherScheme.
+    JoinIndex joinIndexFor(const Tuple &otherScheme) const;
+    
+    /// Performs a natural join to another relation, probing @c otherIndex rather than indexing @c other again.
+    ///
+    /// @c otherIndex must come from @c other.joinIndexFor() given the receiver's scheme.
+    Relation joinedWith(const Relation &other, const JoinIndex &otherIndex) const;
+    
     /// Unions the contents of the receiver with another relation of the same scheme.
     Relation unionWith(const Relation &other) const;
     
+    /// Adds the contents of another relation of the same scheme to the receiver in place.
+    ///
+    /// If the schemes differ, no change will occur.
+    ///
+    /// @returns A relation holding only those rows which were not already in the receiver.
+    Relation insertAll(const Relation &other);
+    
     std::string stringForTuple(const Tuple &tuple) const;
     
+    /// Appends @c stringForTuple(tuple) to @c output, without building a string of its own.
+    void appendTuple(std::string &output, const Tuple &tuple) const;
+    
     bool operator ==(const Relation &other);
     bool operator !=(const Relation &other);
 };
@@ -0,0 +1,222 @@
+//
+//  ResultFormats.cpp
+//  LexerV1
+//
+//  Created by James Robinson on 1/2/20.
+//
+
+#include "ResultFormats.h"
+#include <cstdint>
+#include <unordered_map>
+#include "EvaluatingDatabases.h"
+
+bool resultFormatNamed(const std::string& name, ResultFormat& format) {
+    if (name == "text") {
+        format = ResultFormat::Text;
+    } else if (name == "tsv") {
+        format = ResultFormat::TSV;
+    } else if (name == "csv") {
+        format = ResultFormat::CSV;
+    } else if (name == "binary") {
+        format = ResultFormat::Binary;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/// Returns @c value as it reads between its quotes.
+static std::string unquotedValue(const std::string& value) {
+    if (value.size() < 2 || value.front() != '\'' || value.back() != '\'') {
+        return value;
+    }
+    
+    std::string result = std::string();
+    result.reserve(value.size() - 2);
+    for (size_t i = 1; i + 1 < value.size(); i += 1) {
+        result.push_back(value.at(i));
+        if (value.at(i) == '\'' && i + 2 < value.size() && value.at(i + 1) == '\'') {
+            i += 1; // A quote within a string is written twice.
+        }
+    }
+    return result;
+}
+
+/// Returns the line answering @c query as "Query Evaluation" begins it, such as "r(X)? Yes(2)".
+static std::string answerLine(Predicate* query, size_t matchCount) {
+    return query->toString() + ((matchCount == 0) ? " No" : " Yes(" + std::to_string(matchCount) + ")");
+}
+
+// MARK: - Tables
+
+/// Appends @c value to @c line as a TSV field.
+static void appendTSVField(std::string& line, const std::string& value) {
+    if (!value.empty() && value.front() == '#') {
+        line.push_back('\\'); // Or the line would read as a comment.
+    }
+    for (char character : value) {
+        switch (character) {
+            case '\\': line.append("\\\\"); break;
+            case '\t': line.append("\\t"); break;
+            case '\n': line.append("\\n"); break;
+            case '\r': line.append("\\r"); break;
+            default: line.push_back(character); break;
+        }
+    }
+}
+
+/// Appends @c value to @c line as a CSV field, quoting it only if it must be.
+static void appendCSVField(std::string& line, const std::string& value) {
+    bool needsQuotes = (!value.empty() && value.front() == '#') || value.find_first_of(",\"\r\n") != std::string::npos;
+    if (!needsQuotes) {
+        line.append(value);
+        return;
+    }
+    
+    line.push_back('"');
+    for (char character : value) {
+        if (character == '"') {
+            line.push_back('"');
+        }
+        line.push_back(character);
+    }
+    line.push_back('"');
+}
+
+/// Writes the block answering @c query: its answer line, a header row, its rows, then an empty line.
+static void writeTable(OutputSink& output, Predicate* query, size_t matchCount, const Relation& bindings, bool isTSV) {
+    char separator = isTSV ? '\t' : ',';
+    auto appendField = isTSV ? appendTSVField : appendCSVField;
+    
+    std::string line = "# " + answerLine(query, matchCount) + "\n";
+    output.write(line);
+    
+    if (!bindings.getScheme().empty()) {
+        line.clear();
+        for (size_t col = 0; col < bindings.getScheme().size(); col += 1) {
+            if (col > 0) {
+                line.push_back(separator);
+            }
+            appendField(line, bindings.getScheme().at(col));
+        }
+        line.push_back('\n');
+        output.write(line);
+        
+        for (const Tuple& row : bindings.getContents()) {
+            line.clear();
+            for (size_t col = 0; col < row.size(); col += 1) {
+                if (col > 0) {
+                    line.push_back(separator);
+                }
+                appendField(line, unquotedValue(row.at(col)));
+            }
+            line.push_back('\n');
+            output.write(line);
+        }
+    }
+    
+    output << '\n';
+}
+
+// MARK: - Binary
+
+/// The distinct values written, each numbered by when it was first seen.
+struct SymbolTable {
+    /// Keyed by each value as the relations store it, quotes and all.
+    std::unordered_map<std::string, uint32_t> codes;
+    std::vector<std::string> symbols;
+    
+    uint32_t codeFor(const std::string& storedValue) {
+        auto found = codes.find(storedValue);
+        if (found != codes.end()) {
+            return found->second;
+        }
+        
+        uint32_t code = static_cast<uint32_t>(symbols.size());
+        codes.insert(std::make_pair(storedValue, code));
+        symbols.push_back(unquotedValue(storedValue));
+        return code;
+    }
+};
+
+/// One query's answer, with its values replaced by their symbol codes.
+struct EncodedAnswer {
+    std::string text;
+    size_t matchCount;
+    Tuple columns;
+    size_t rowCount;
+    /// The codes of each column in turn, one per row.
+    std::vector<std::vector<uint32_t>> codes;
+};
+
+static void writeBinaryResults(Database* database,
+                               DatalogProgram* program,
+                               OutputSink& output,
+                               const CompiledProgram* compiled) {
+    // The dictionary comes first, so every answer must be encoded before anything is written. Only their codes are kept.
+    SymbolTable symbols = SymbolTable();
+    std::vector<EncodedAnswer> answers = std::vector<EncodedAnswer>();
+    forEachQueryAnswer(database, program, [&](Predicate* query, size_t matchCount, const Relation& bindings) {
+        EncodedAnswer answer = EncodedAnswer();
+        answer.text = query->toString();
+        answer.matchCount = matchCount;
+        answer.columns = bindings.getScheme();
+        answer.rowCount = answer.columns.empty() ? 0 : bindings.getContents().size();
+        answer.codes = std::vector<std::vector<uint32_t>>(answer.columns.size());
+        for (auto& column : answer.codes) {
+            column.reserve(answer.rowCount);
+        }
+        
+        for (const Tuple& row : bindings.getContents()) {
+            for (size_t col = 0; col < answer.columns.size(); col += 1) {
+                answer.codes[col].push_back(symbols.codeFor(row[col]));
+            }
+        }
+        answers.push_back(std::move(answer));
+    }, compiled);
+    
+    BinaryWriter writer = BinaryWriter(output);
+    writer.writeBytes("DLQR", 4);
+    writer.writeInteger(1, 4);
+    
+    writer.writeSymbols(symbols.symbols);
+    
+    writer.writeInteger(answers.size());
+    for (const auto& answer : answers) {
+        writer.writeString(answer.text);
+        writer.writeInteger(answer.matchCount);
+        writer.writeInteger(answer.columns.size());
+        writer.writeInteger(answer.rowCount);
+        for (const auto& column : answer.columns) {
+            writer.writeString(column);
+        }
+        for (const auto& column : answer.codes) {
+            writer.writeCodes(column);
+        }
+    }
+}
+
+// MARK: - Writing
+
+void writeQueryResults(Database* database,
+                       DatalogProgram* program,
+                       OutputSink& output,
+                       ResultFormat format,
+                       const CompiledProgram* compiled) {
+    switch (format) {
+        case ResultFormat::Text:
+            evaluateQueries(database, program, output, true, compiled);
+            break;
+        
+        case ResultFormat::TSV:
+        case ResultFormat::CSV:
+            forEachQueryAnswer(database, program, [&](Predicate* query, size_t matchCount, const Relation& bindings) {
+                writeTable(output, query, matchCount, bindings, format == ResultFormat::TSV);
+            }, compiled);
+            break;
+        
+        case ResultFormat::Binary:
+            writeBinaryResults(database, program, output, compiled);
+            break;
+    }
+}
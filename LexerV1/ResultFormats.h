@@ -0,0 +1,58 @@
+//
+//  ResultFormats.h
+//  LexerV1
+//
+//  Created by James Robinson on 1/2/20.
+//
+
+#ifndef ResultFormats_h
+#define ResultFormats_h
+
+#include <string>
+#include "Database.h"
+#include "DatalogProgram.h"
+#include "CompiledProgram.h"
+#include "OutputSink.h"
+
+/// How query results are written.
+enum class ResultFormat {
+    /// The rule trace and "Query Evaluation", as @c evaluateRules and @c evaluateQueries write them.
+    Text,
+    /// A table for each query, its columns separated by tabs.
+    TSV,
+    /// A table for each query, its columns separated by commas.
+    CSV,
+    /// A symbol dictionary, then a fixed-width column of symbol codes for each variable of each query.
+    Binary,
+};
+
+/// Finds the format named @c name: "text", "tsv", "csv" or "binary".
+///
+/// @returns @c false if no format has that name.
+bool resultFormatNamed(const std::string& name, ResultFormat& format);
+
+/// Writes the answers to @c program's queries to @c output in @c format. The rules must already have been evaluated.
+///
+/// Values are written as they read between their quotes, so @c 'it''s' is written @c it's.
+///
+/// In TSV and CSV, each query gets a block: a line holding "# ", the query and "Yes(n)" or "No"; a header row naming its
+/// variables; a row for each distinct binding of them; then an empty line. A query without variables has no header or rows.
+/// TSV escapes backslashes, tabs, newlines and carriage returns within values as \\, \t, \n and \r, and a "#" beginning a
+/// value as \#. CSV quotes values holding commas, quotes or line breaks, or beginning with "#", doubling the quotes within
+/// them.
+///
+/// The binary format is made to be mapped into memory and read in place. Every integer is little-endian and 64 bits wide,
+/// apart from symbol codes, which are 32 bits wide, and every part below begins 8-byte aligned, padded with zeros:
+///
+/// - The magic bytes "DLQR", then the format version, 1, as a 32-bit integer.
+/// - The symbol count, then that many plus one offsets into the symbol bytes which follow. Symbol @c i spans from offset
+///   @c i up to offset @c i + 1.
+/// - The query count, then for each query: the length of its text and the text; how many rows it matched; its column
+///   count and row count; the length and text of each column's name; then each column's symbol codes, one per row.
+void writeQueryResults(Database* database,
+                       DatalogProgram* program,
+                       OutputSink& output,
+                       ResultFormat format,
+                       const CompiledProgram* compiled = nullptr);
+
+#endif /* ResultFormats_h */
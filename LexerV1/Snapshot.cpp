@@ -0,0 +1,316 @@
+//
+//  Snapshot.cpp
+//  LexerV1
+//
+//  Created by James Robinson on 1/4/20.
+//
+
+#include "Snapshot.h"
+#include <cstdint>
+#include <cstdio>
+#include <set>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "OutputSink.h"
+#include "ThreadPool.h"
+
+/// The version of the layout @c saveSnapshot writes.
+const uint32_t SNAPSHOT_VERSION = 1;
+
+// MARK: - Saving
+
+bool saveSnapshot(Database* database, const std::string& path, std::string& error) {
+    // Number every value, so that each is written once.
+    std::unordered_map<std::string, uint32_t> codes = std::unordered_map<std::string, uint32_t>();
+    std::vector<std::string> symbols = std::vector<std::string>();
+    for (auto relation : database->getRelations()) {
+        for (const Tuple& row : relation->getContents()) {
+            for (const auto& value : row) {
+                if (codes.insert(std::make_pair(value, static_cast<uint32_t>(symbols.size()))).second) {
+                    symbols.push_back(value);
+                }
+            }
+        }
+    }
+    
+    std::string partialPath = path + ".partial";
+    int file = open(partialPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file < 0) {
+        error = "The file '" + partialPath + "' could not be opened.";
+        return false;
+    }
+    
+    bool didFail = false;
+    {
+        FileDescriptorSink output = FileDescriptorSink(file);
+        BinaryWriter writer = BinaryWriter(output);
+        writer.writeBytes("DLDB", 4);
+        writer.writeInteger(SNAPSHOT_VERSION, 4);
+        writer.writeSymbols(symbols);
+        
+        writer.writeInteger(database->getRelations().size());
+        for (auto relation : database->getRelations()) {
+            writer.writeString(relation->getName());
+            writer.writeInteger(relation->getColumnCount());
+            writer.writeInteger(relation->getContents().size());
+            for (const auto& column : relation->getScheme()) {
+                writer.writeString(column);
+            }
+            
+            std::vector<uint32_t> column = std::vector<uint32_t>();
+            column.reserve(relation->getContents().size());
+            for (size_t col = 0; col < relation->getColumnCount(); col += 1) {
+                column.clear();
+                for (const Tuple& row : relation->getContents()) {
+                    column.push_back(codes.at(row.at(col)));
+                }
+                writer.writeCodes(column);
+            }
+        }
+        
+        output.flush();
+        didFail = output.hasFailed();
+    }
+    didFail = (close(file) != 0) || didFail;
+    
+    if (didFail || rename(partialPath.c_str(), path.c_str()) != 0) {
+        unlink(partialPath.c_str());
+        error = "The snapshot '" + path + "' could not be written.";
+        return false;
+    }
+    return true;
+}
+
+// MARK: - Loading
+
+/// Reads a mapped snapshot in place, refusing to read past its end.
+class SnapshotReader {
+private:
+    const unsigned char* bytes;
+    size_t size;
+    size_t offset;
+    
+public:
+    SnapshotReader(const unsigned char* bytes, size_t size) {
+        this->bytes = bytes;
+        this->size = size;
+        this->offset = 0;
+    }
+    
+    size_t remainingCount() const {
+        return size - offset;
+    }
+    
+    /// Returns the next @c length bytes, or @c nullptr if the snapshot ends first.
+    const unsigned char* readBytes(size_t length) {
+        if (length > size - offset) {
+            return nullptr;
+        }
+        const unsigned char* result = bytes + offset;
+        offset += length;
+        return result;
+    }
+    
+    /// Reads a little-endian integer @c width bytes wide.
+    bool readInteger(uint64_t& value, size_t width = 8) {
+        const unsigned char* data = readBytes(width);
+        if (data == nullptr) {
+            return false;
+        }
+        value = 0;
+        for (size_t i = 0; i < width; i += 1) {
+            value |= static_cast<uint64_t>(data[i]) << (8 * i);
+        }
+        return true;
+    }
+    
+    /// Skips to the next multiple of 8 bytes.
+    bool skipPadding() {
+        return readBytes((8 - offset % 8) % 8) != nullptr;
+    }
+    
+    /// Reads a length, then that many bytes of text, padded.
+    bool readString(std::string& text) {
+        uint64_t length = 0;
+        const unsigned char* data = nullptr;
+        if (!readInteger(length) || length > size || (data = readBytes(length)) == nullptr) {
+            return false;
+        }
+        text.assign(reinterpret_cast<const char*>(data), length);
+        return skipPadding();
+    }
+    
+    /// Returns @c count 32-bit codes, padded, to be read in place with @c codeAt.
+    const unsigned char* readCodes(uint64_t count) {
+        if (count > size / 4) {
+            return nullptr;
+        }
+        const unsigned char* data = readBytes(count * 4);
+        return (data != nullptr && skipPadding()) ? data : nullptr;
+    }
+    
+    static uint32_t codeAt(const unsigned char* codes, size_t index) {
+        const unsigned char* code = codes + index * 4;
+        return static_cast<uint32_t>(code[0]) | (static_cast<uint32_t>(code[1]) << 8)
+            | (static_cast<uint32_t>(code[2]) << 16) | (static_cast<uint32_t>(code[3]) << 24);
+    }
+};
+
+/// A relation as a snapshot holds it, its codes still in the mapped file.
+struct SavedRelation {
+    std::string name;
+    Tuple scheme;
+    size_t rowCount;
+    /// Each column's codes, one per row.
+    std::vector<const unsigned char*> columns;
+    /// The relation its rows go to.
+    Relation* relation;
+};
+
+/// Reads the dictionary and the relations' headers from @c reader, checking every code against the dictionary.
+static bool readSnapshot(SnapshotReader& reader, std::vector<std::string>& symbols, std::vector<SavedRelation>& saved) {
+    const unsigned char* magic = reader.readBytes(4);
+    uint64_t version = 0;
+    if (magic == nullptr || std::string(reinterpret_cast<const char*>(magic), 4) != "DLDB"
+        || !reader.readInteger(version, 4) || version != SNAPSHOT_VERSION) {
+        return false;
+    }
+    
+    uint64_t symbolCount = 0;
+    if (!reader.readInteger(symbolCount) || symbolCount >= UINT32_MAX) {
+        return false;
+    }
+    const unsigned char* offsets = reader.readBytes((symbolCount + 1) * 8);
+    if (offsets == nullptr) {
+        return false;
+    }
+    SnapshotReader offsetReader = SnapshotReader(offsets, (symbolCount + 1) * 8);
+    std::vector<uint64_t> symbolOffsets = std::vector<uint64_t>(symbolCount + 1);
+    for (auto& symbolOffset : symbolOffsets) {
+        offsetReader.readInteger(symbolOffset);
+    }
+    const unsigned char* symbolBytes = reader.readBytes(symbolOffsets.back());
+    if (symbolBytes == nullptr || !reader.skipPadding()) {
+        return false;
+    }
+    symbols.reserve(symbolCount);
+    for (size_t i = 0; i < symbolCount; i += 1) {
+        if (symbolOffsets[i] > symbolOffsets[i + 1] || symbolOffsets[i + 1] > symbolOffsets.back()) {
+            return false;
+        }
+        symbols.push_back(std::string(reinterpret_cast<const char*>(symbolBytes + symbolOffsets[i]),
+                                      symbolOffsets[i + 1] - symbolOffsets[i]));
+    }
+    
+    uint64_t relationCount = 0;
+    if (!reader.readInteger(relationCount)) {
+        return false;
+    }
+    std::set<std::string> names = std::set<std::string>();
+    for (uint64_t i = 0; i < relationCount; i += 1) {
+        SavedRelation relation = SavedRelation();
+        uint64_t columnCount = 0;
+        uint64_t rowCount = 0;
+        if (!reader.readString(relation.name) || !reader.readInteger(columnCount) || !reader.readInteger(rowCount)
+            || columnCount > reader.remainingCount() / 8 || (columnCount == 0 && rowCount > 1)
+            || !names.insert(relation.name).second) {
+            return false;
+        }
+        relation.rowCount = rowCount;
+        
+        relation.scheme = Tuple(std::vector<std::string>(columnCount));
+        for (auto& column : relation.scheme) {
+            if (!reader.readString(column)) {
+                return false;
+            }
+        }
+        for (uint64_t col = 0; col < columnCount; col += 1) {
+            const unsigned char* codes = reader.readCodes(rowCount);
+            if (codes == nullptr) {
+                return false;
+            }
+            for (size_t row = 0; row < rowCount; row += 1) {
+                if (SnapshotReader::codeAt(codes, row) >= symbolCount) {
+                    return false;
+                }
+            }
+            relation.columns.push_back(codes);
+        }
+        saved.push_back(relation);
+    }
+    
+    return true;
+}
+
+bool loadSnapshot(Database* database, const std::string& path, std::string& error) {
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        error = "The snapshot '" + path + "' could not be opened.";
+        return false;
+    }
+    
+    struct stat status = {};
+    if (fstat(file, &status) != 0 || status.st_size == 0) {
+        close(file);
+        error = "The snapshot '" + path + "' could not be read.";
+        return false;
+    }
+    size_t size = static_cast<size_t>(status.st_size);
+    
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapped == MAP_FAILED) {
+        error = "The snapshot '" + path + "' could not be read.";
+        return false;
+    }
+    
+    SnapshotReader reader = SnapshotReader(static_cast<const unsigned char*>(mapped), size);
+    std::vector<std::string> symbols = std::vector<std::string>();
+    std::vector<SavedRelation> saved = std::vector<SavedRelation>();
+    if (!readSnapshot(reader, symbols, saved)) {
+        munmap(mapped, size);
+        error = "The file '" + path + "' is not a snapshot this program can read.";
+        return false;
+    }
+    
+    for (auto& relation : saved) {
+        Relation* extantRelation = database->relationWithName(relation.name);
+        if (extantRelation != nullptr && extantRelation->getColumnCount() != relation.scheme.size()) {
+            munmap(mapped, size);
+            error = "The snapshot's relation " + relation.name + " has " + std::to_string(relation.scheme.size())
+                + " columns, but the program's has " + std::to_string(extantRelation->getColumnCount()) + ".";
+            return false;
+        }
+    }
+    
+    for (auto& relation : saved) {
+        relation.relation = database->relationWithName(relation.name);
+        if (relation.relation == nullptr) {
+            relation.relation = new Relation(relation.name, relation.scheme);
+            database->addRelation(relation.relation);
+        } else {
+            *relation.relation = Relation(relation.relation->getName(), relation.relation->getScheme());
+        }
+    }
+    
+    // Each relation is only touched by its own task, and was saved in order, so each row lands after the one before.
+    ThreadPool::shared().parallelFor(saved.size(), [&](size_t i) {
+        const SavedRelation& relation = saved.at(i);
+        std::vector<Tuple> rows = std::vector<Tuple>();
+        rows.reserve(relation.rowCount);
+        for (size_t row = 0; row < relation.rowCount; row += 1) {
+            Tuple tuple = Tuple(std::vector<std::string>(relation.columns.size()));
+            for (size_t col = 0; col < relation.columns.size(); col += 1) {
+                tuple[col] = symbols[SnapshotReader::codeAt(relation.columns[col], row)];
+            }
+            rows.push_back(std::move(tuple));
+        }
+        relation.relation->addTuples(rows);
+    });
+    
+    munmap(mapped, size);
+    return true;
+}
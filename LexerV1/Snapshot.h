@@ -0,0 +1,41 @@
+//
+//  Snapshot.h
+//  LexerV1
+//
+//  Created by James Robinson on 1/4/20.
+//
+
+#ifndef Snapshot_h
+#define Snapshot_h
+
+#include <string>
+#include "Database.h"
+
+/// Writes every relation in @c database to @c path, so that a later run can pick up where this one left off.
+///
+/// The snapshot is laid out like the binary query results, little-endian and 8-byte aligned, for reading in place once
+/// mapped:
+///
+/// - The magic bytes "DLDB", then the format version, 1, as a 32-bit integer.
+/// - A symbol dictionary, as @c BinaryWriter::writeSymbols writes it, of every value as the relations store it, quotes
+///   and all.
+/// - The relation count, then for each relation: its name; its column count and row count; the name of each column; then
+///   each column's 32-bit symbol codes, one per row, in the order the relation sorts its rows.
+///
+/// The snapshot is written beside @c path and moved into place once it's whole, so a failed save leaves any earlier one be.
+///
+/// @returns @c false if the file couldn't be written, in which case @c error says why.
+bool saveSnapshot(Database* database, const std::string& path, std::string& error);
+
+/// Restores the relations saved in the snapshot at @c path to @c database. Each one's rows replace those of the relation
+/// of the same name, which keeps its scheme, and any relation @c database lacks is added. Relations the snapshot doesn't
+/// hold are left be.
+///
+/// The file is mapped read-only and checked before anything changes. The relations are then filled at once across the
+/// shared thread pool, each from rows already in order.
+///
+/// @returns @c false if the file couldn't be read, isn't a snapshot, or holds a relation whose columns differ in number
+/// from the one of the same name in @c database, in which case @c error says why and nothing changes.
+bool loadSnapshot(Database* database, const std::string& path, std::string& error);
+
+#endif /* Snapshot_h */
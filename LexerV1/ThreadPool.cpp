@@ -0,0 +1,273 @@
+//
+//  ThreadPool.cpp
+//  LexerV1
+//
+//  Created by James Robinson on 12/16/19.
+//
+
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <queue>
+
+/// The pool whose worker is running on this thread, if any, and that worker's index.
+static thread_local ThreadPool* currentPool = nullptr;
+static thread_local size_t currentWorker = 0;
+
+ThreadPool::ThreadPool(size_t threadCount) {
+    this->isStopping = false;
+    this->pendingCount = 0;
+    
+    if (threadCount < 2) {
+        return; // Just us? No workers.
+    }
+    
+    for (size_t i = 0; i < threadCount; i += 1) {
+        queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+    }
+    for (size_t i = 0; i < threadCount; i += 1) {
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepLock);
+        isStopping = true;
+    }
+    tasksChanged.notify_all();
+    
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+size_t ThreadPool::getThreadCount() const {
+    return std::max(workers.size(), static_cast<size_t>(1));
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    if (workers.empty()) {
+        task(); // No workers? Do it now.
+        return;
+    }
+    
+    // Our own workers keep what they make; anyone else hands it in.
+    WorkQueue& queue = (currentPool == this) ? *queues.at(currentWorker) : injected;
+    {
+        std::lock_guard<std::mutex> lock(queue.lock);
+        queue.tasks.push_back(std::move(task));
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(sleepLock);
+        pendingCount += 1;
+    }
+    tasksChanged.notify_one();
+}
+
+bool ThreadPool::takeTask(size_t index, std::function<void()>& task) {
+    // Newest of our own first, while it's still warm in the cache.
+    if (index < queues.size()) {
+        WorkQueue& own = *queues.at(index);
+        std::lock_guard<std::mutex> lock(own.lock);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            pendingCount -= 1;
+            return true;
+        }
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(injected.lock);
+        if (!injected.tasks.empty()) {
+            task = std::move(injected.tasks.front());
+            injected.tasks.pop_front();
+            pendingCount -= 1;
+            return true;
+        }
+    }
+    
+    // Steal the oldest from a neighbor.
+    for (size_t offset = 1; offset <= queues.size(); offset += 1) {
+        WorkQueue& victim = *queues.at((index + offset) % queues.size());
+        std::lock_guard<std::mutex> lock(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            pendingCount -= 1;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+bool ThreadPool::runPendingTask() {
+    std::function<void()> task;
+    size_t index = (currentPool == this) ? currentWorker : queues.size();
+    if (!takeTask(index, task)) {
+        return false;
+    }
+    
+    task();
+    return true;
+}
+
+void ThreadPool::workerLoop(size_t index) {
+    currentPool = this;
+    currentWorker = index;
+    
+    while (true) {
+        std::function<void()> task;
+        if (takeTask(index, task)) {
+            task();
+            continue;
+        }
+        
+        std::unique_lock<std::mutex> lock(sleepLock);
+        if (isStopping && pendingCount == 0) {
+            return; // Stopping, and nothing left to do.
+        }
+        tasksChanged.wait(lock, [this] { return isStopping || pendingCount > 0; });
+    }
+}
+
+void ThreadPool::helpUntil(const std::function<bool()>& isDone) {
+    while (!isDone()) {
+        if (runPendingTask()) {
+            continue;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& body) {
+    if (workers.empty() || count < 2) {
+        for (size_t i = 0; i < count; i += 1) {
+            body(i);
+        }
+        return;
+    }
+    
+    struct Batch {
+        std::atomic<size_t> next;
+        std::atomic<size_t> remaining;
+    };
+    auto batch = std::make_shared<Batch>();
+    batch->next = 0;
+    batch->remaining = count;
+    
+    // Each runner claims indices until none are left.
+    auto runner = [batch, count, &body]() {
+        for (size_t i = batch->next++; i < count; i = batch->next++) {
+            body(i);
+            batch->remaining -= 1;
+        }
+    };
+    
+    size_t helpers = std::min(workers.size(), count - 1);
+    for (size_t i = 0; i < helpers; i += 1) {
+        submit(runner);
+    }
+    runner();
+    
+    // Help with whatever else is queued while the stragglers finish, so nested calls can't starve the pool.
+    helpUntil([&batch] { return batch->remaining == 0; });
+}
+
+void ThreadPool::runTaskGraph(const std::vector<std::vector<size_t>>& successors,
+                              const std::vector<size_t>& priority,
+                              const std::function<void(size_t)>& body) {
+    size_t count = successors.size();
+    std::vector<size_t> waitingOn(count, 0);
+    for (const auto& next : successors) {
+        for (auto task : next) {
+            waitingOn.at(task) += 1;
+        }
+    }
+    
+    auto byPriority = [&priority](size_t a, size_t b) {
+        // Greatest priority on top; ties go to the earlier task.
+        return priority.at(a) != priority.at(b) ? priority.at(a) < priority.at(b) : a > b;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(byPriority)> ready(byPriority);
+    for (size_t task = 0; task < count; task += 1) {
+        if (waitingOn.at(task) == 0) {
+            ready.push(task);
+        }
+    }
+    
+    if (workers.empty()) {
+        // No workers? Run them here, one at a time.
+        while (!ready.empty()) {
+            size_t task = ready.top();
+            ready.pop();
+            body(task);
+            for (auto next : successors.at(task)) {
+                if (--waitingOn.at(next) == 0) {
+                    ready.push(next);
+                }
+            }
+        }
+        return;
+    }
+    
+    std::mutex readyLock;
+    std::atomic<size_t> remaining(count);
+    
+    // Each submission runs whichever ready task matters most at the moment it starts, not when it was queued.
+    std::function<void()> runNext;
+    runNext = [&]() {
+        size_t task;
+        {
+            std::lock_guard<std::mutex> lock(readyLock);
+            task = ready.top();
+            ready.pop();
+        }
+        
+        body(task);
+        
+        size_t newlyReady = 0;
+        {
+            std::lock_guard<std::mutex> lock(readyLock);
+            for (auto next : successors.at(task)) {
+                if (--waitingOn.at(next) == 0) {
+                    ready.push(next);
+                    newlyReady += 1;
+                }
+            }
+        }
+        for (size_t i = 0; i < newlyReady; i += 1) {
+            submit(runNext);
+        }
+        remaining -= 1;
+    };
+    
+    size_t initiallyReady = ready.size();
+    for (size_t i = 0; i < initiallyReady; i += 1) {
+        submit(runNext);
+    }
+    
+    helpUntil([&remaining] { return remaining == 0; });
+}
+
+// MARK: - Shared Pool
+
+static std::unique_ptr<ThreadPool> sharedPool = nullptr;
+static std::mutex sharedPoolLock;
+
+ThreadPool& ThreadPool::shared() {
+    std::lock_guard<std::mutex> lock(sharedPoolLock);
+    if (sharedPool == nullptr) {
+        sharedPool = std::unique_ptr<ThreadPool>(new ThreadPool());
+    }
+    return *sharedPool;
+}
+
+void ThreadPool::setSharedThreadCount(size_t threadCount) {
+    std::lock_guard<std::mutex> lock(sharedPoolLock);
+    sharedPool = std::unique_ptr<ThreadPool>(new ThreadPool(threadCount));
+}
@@ -0,0 +1,82 @@
+//
+//  ThreadPool.h
+//  LexerV1
+//
+//  Created by James Robinson on 12/16/19.
+//
+
+#ifndef ThreadPool_h
+#define ThreadPool_h
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/// A work-stealing pool. Each worker keeps its own queue, taking its newest task first; idle workers take the oldest task
+/// from their neighbors' queues.
+class ThreadPool {
+public:
+    /// Creates a pool with @c threadCount worker threads. A pool of fewer than two threads runs everything on the calling thread.
+    ThreadPool(size_t threadCount = std::thread::hardware_concurrency());
+    ~ThreadPool();
+    
+    size_t getThreadCount() const;
+    
+    /// Queues @c task to run on some worker thread.
+    void submit(std::function<void()> task);
+    
+    /// Calls @c body once with each index from @c 0 up to (but not including) @c count, spread across the pool,
+    /// and returns once every call has finished. The calling thread takes part, so this may be called from within a task.
+    void parallelFor(size_t count, const std::function<void(size_t)>& body);
+    
+    /// Calls @c body once with the index of each task in a dependency graph, and returns once every call has finished.
+    ///
+    /// A task starts only after each task that lists it in @c successors has finished. Of the tasks ready to start,
+    /// the one with the greatest @c priority goes first.
+    void runTaskGraph(const std::vector<std::vector<size_t>>& successors,
+                      const std::vector<size_t>& priority,
+                      const std::function<void(size_t)>& body);
+    
+    /// The pool used by relational operations.
+    static ThreadPool& shared();
+    
+    /// Replaces the shared pool with one of @c threadCount threads. Call this before any work is queued.
+    static void setSharedThreadCount(size_t threadCount);
+    
+private:
+    struct WorkQueue {
+        std::deque<std::function<void()>> tasks;
+        std::mutex lock;
+    };
+    
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    
+    /// Tasks submitted from outside the pool.
+    WorkQueue injected;
+    
+    std::atomic<size_t> pendingCount;
+    std::mutex sleepLock;
+    std::condition_variable tasksChanged;
+    bool isStopping;
+    
+    /// Takes the next task for the worker at @c index, stealing if its own queue is empty.
+    /// Threads outside the pool pass the number of workers.
+    bool takeTask(size_t index, std::function<void()>& task);
+    
+    /// Runs the next queued task on the calling thread.
+    /// @returns @c false if no task was waiting.
+    bool runPendingTask();
+    
+    /// Runs queued tasks on the calling thread until @c isDone returns @c true.
+    void helpUntil(const std::function<bool()>& isDone);
+    
+    void workerLoop(size_t index);
+};
+
+#endif /* ThreadPool_h */
@@ -20,6 +20,20 @@ Tuple::Tuple(const Tuple &other) {
     }
 }
 
+Tuple::Tuple(Tuple &&other) noexcept : std::vector<std::string>(std::move(other)) {
+    
+}
+
+Tuple& Tuple::operator =(const Tuple &other) {
+    std::vector<std::string>::operator =(other);
+    return *this;
+}
+
+Tuple& Tuple::operator =(Tuple &&other) noexcept {
+    std::vector<std::string>::operator =(std::move(other));
+    return *this;
+}
+
 Tuple Tuple::combinedWith(const Tuple& other) const {
     Tuple result = Tuple();
     
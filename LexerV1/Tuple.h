@@ -17,6 +17,10 @@ class Tuple: public std::vector<std::string> {
 public:
     Tuple(std::vector<std::string> contents = {});
     Tuple(const Tuple &other);
+    Tuple(Tuple &&other) noexcept;
+    
+    Tuple& operator =(const Tuple &other);
+    Tuple& operator =(Tuple &&other) noexcept;
     
     /// Concatinates the values of @c other uniquely with the receiver's contents.
     Tuple combinedWith(const Tuple& other) const;
@@ -8,24 +8,120 @@
 #include <iostream>
 #include <fstream>
 #include <map>
+#include <algorithm>
+#include <cstdlib>
+#include <unistd.h>
 #include "Lexer.h"
 #include "Recognizers.h"
 #include "DatalogCheck.h"
 #include "EvaluatingDatabases.h"
+#include "CodeGenerator.h"
+#include "MagicSets.h"
+#include "DatalogServer.h"
+#include "ThreadPool.h"
+#include "OutputSink.h"
+#include "ResultFormats.h"
+#include "FactFiles.h"
+#include "Snapshot.h"
 
 int main(int argc, char* argv[]) {
     std::string filename = "";
-    bool uiLogging = (argc <= 1);
+    EvaluationOptions options = EvaluationOptions();
+    bool dumpingCompiledProgram = false;
+    bool pruningToQueries = false;
+    bool rewritingMagicSets = false;
+    std::string generatedFilename = "";
+    bool serving = false;
+    std::string socketPath = "";
+    ResultFormat resultFormat = ResultFormat::Text;
+    std::vector<FactFile> factFiles = std::vector<FactFile>();
+    std::string snapshotPath = "";
+    std::string savedSnapshotPath = "";
+    bool evaluatingRules = true;
+    
+    for (int i = 1; i < argc; i += 1) {
+        std::string arg = argv[i];
+        
+        if (arg == "--threads" && i + 1 < argc) {
+            // Spread evaluation across this many threads.
+            ThreadPool::setSharedThreadCount(std::max(std::atoi(argv[i + 1]), 1));
+            i += 1;
+            
+        } else if (arg == "--parallel-rules") {
+            // Evaluate the rules within each pass at once.
+            options.synchronousPasses = true;
+            
+        } else if (arg == "--dump-ir") {
+            // Describe the compiled rules and queries before running them.
+            dumpingCompiledProgram = true;
+            
+        } else if (arg == "--prune") {
+            // Skip rules and relations no query depends on.
+            pruningToQueries = true;
+            
+        } else if (arg == "--magic-sets") {
+            // Derive only the rows the queries can ask for.
+            rewritingMagicSets = true;
+            
+        } else if (arg == "--compile" && i + 1 < argc) {
+            // Write a C++ program which evaluates this one, instead of evaluating it.
+            generatedFilename = argv[i + 1];
+            i += 1;
+            
+        } else if (arg == "--format" && i + 1 < argc) {
+            // Write only the query results, as text, tsv, csv or binary.
+            if (!resultFormatNamed(argv[i + 1], resultFormat)) {
+                std::cout << "Unknown format '" << argv[i + 1] << "'. Expected text, tsv, csv or binary." << std::endl;
+                return 1;
+            }
+            i += 1;
+            
+        } else if (arg == "--load" && i + 1 < argc) {
+            // Add the rows of a TSV or CSV file to a relation, given as relation=path.
+            FactFile factFile = FactFile();
+            if (!factFileFromArgument(argv[i + 1], factFile)) {
+                std::cout << "Expected relation=path after --load, not '" << argv[i + 1] << "'." << std::endl;
+                return 1;
+            }
+            factFiles.push_back(factFile);
+            i += 1;
+            
+        } else if (arg == "--snapshot" && i + 1 < argc) {
+            // Start from the relations a snapshot holds, in place of the program's facts for them.
+            snapshotPath = argv[i + 1];
+            i += 1;
+            
+        } else if (arg == "--save-snapshot" && i + 1 < argc) {
+            // Write every relation to a snapshot once the rules are evaluated.
+            savedSnapshotPath = argv[i + 1];
+            i += 1;
+            
+        } else if (arg == "--skip-rules") {
+            // Answer the queries from the relations as they stand, as when a snapshot already holds the rules' results.
+            evaluatingRules = false;
+            
+        } else if (arg == "--serve") {
+            // Keep the database in memory after evaluating, answering commands from standard input.
+            serving = true;
+            
+        } else if (arg == "--socket" && i + 1 < argc) {
+            // As --serve, but answering commands over a Unix domain socket.
+            serving = true;
+            socketPath = argv[i + 1];
+            i += 1;
+            
+        } else if (filename.empty()) {
+            filename = arg;
+        }
+    }
+    
+    bool uiLogging = filename.empty();
     
     if (uiLogging) {
         // If user didn't send anything in command line, ask for input.
         std::cout << "=== Welcome to RoLexer (V1) ===" << std::endl;
         std::cout << "Enter the path to a datalog file: ";
         std::cin >> filename;
-        
-    } else {
-        // Silently take input if user passed a filename.
-        filename = argv[1];
     }
     
     std::ifstream iFS = std::ifstream();
@@ -50,7 +146,7 @@ int main(int argc, char* argv[]) {
     // Parse tokens
     std::vector<Token*> tokens = collectedTokensFromFile(iFS);
     iFS.close();
-    
+
 //    printTokens(tokens);
     
     DatalogCheck checker = DatalogCheck();
@@ -59,23 +155,143 @@ int main(int argc, char* argv[]) {
     if (program == nullptr) {
         return 0;
     }
-    
+
 //    std::cout << checker.getResultMsg() << std::endl;
     
+    // Evaluate each rewritten program in place of the one it came from, keeping that to free at the end.
+    // Ad-hoc queries may ask for anything, so a server keeps every relation whole.
+    std::vector<DatalogProgram*> replacedPrograms = std::vector<DatalogProgram*>();
+    if (pruningToQueries && !serving) {
+        replacedPrograms.push_back(program);
+        program = programForQueries(program);
+    }
+    if (rewritingMagicSets && !serving) {
+        DatalogProgram* magicProgram = magicSetsProgram(program);
+        if (magicProgram != nullptr) {
+            replacedPrograms.push_back(program);
+            program = magicProgram;
+        }
+    }
+    
     Database* database = new Database();
-    std::ostringstream output = std::ostringstream();
     
     evaluateSchemes(database, program);
     evaluateFacts(database, program);
-    output << evaluateRules(database, program, true);
-    output << evaluateQueries(database, program);
     
-    std::cout << output.str() << std::endl;
+    // Restore the snapshot, then add the rows of the files the program names, then of those given on the command line.
+    size_t directoryEnd = filename.find_last_of('/');
+    std::vector<FactFile> namedFactFiles = factFilesInTokens(tokens, (directoryEnd == std::string::npos) ? "" :
+                                                             filename.substr(0, directoryEnd));
+    factFiles.insert(factFiles.begin(), namedFactFiles.begin(), namedFactFiles.end());
+    
+    std::string error = "";
+    if (!snapshotPath.empty()) {
+        loadSnapshot(database, snapshotPath, error);
+    }
+    for (size_t i = 0; i < factFiles.size() && error.empty(); i += 1) {
+        const FactFile& factFile = factFiles.at(i);
+        Relation* relation = database->relationWithName(factFile.relationName);
+        if (relation == nullptr && pruningToQueries && !serving) {
+            continue; // No query reads it.
+        }
+        
+        if (relation == nullptr) {
+            error = "There is no relation named " + factFile.relationName + " to load '" + factFile.path + "' into.";
+        } else {
+            loadFactFile(relation, factFile.path, error);
+        }
+    }
+    
+    if (!error.empty()) {
+        std::cout << error << std::endl;
+        delete program;
+        for (auto replacedProgram : replacedPrograms) {
+            delete replacedProgram;
+        }
+        delete database;
+        releaseTokens(tokens);
+        return 1;
+    }
+    
+    if (!generatedFilename.empty()) {
+        CodeGenerator generator = CodeGenerator(program, database);
+        bool didGenerate = false;
+        
+        if (!generator.canGenerate()) {
+            std::cout << "Could not compile: " << generator.getUnsupportedReason() << std::endl;
+            
+        } else {
+            std::ofstream oFS = std::ofstream(generatedFilename);
+            if (oFS.is_open()) {
+                oFS << generator.generatedSource();
+                didGenerate = true;
+            } else {
+                std::cout << "The file '" << generatedFilename << "' could not be opened." << std::endl;
+            }
+        }
+        
+        delete program;
+        for (auto replacedProgram : replacedPrograms) {
+            delete replacedProgram;
+        }
+        delete database;
+        releaseTokens(tokens);
+        return didGenerate ? 0 : 1;
+    }
+    
+    CompiledProgram compiled = CompiledProgram(program, database);
+    options.compiled = &compiled;
+    if (dumpingCompiledProgram) {
+        std::cerr << compiled.toString() << std::endl;
+    }
+    
+    // Write the trace as it's produced, rather than holding it all until the end. A server answers for itself, and tables
+    // are for other programs to read, so neither gets a trace.
+    std::cout.flush();
+    FileDescriptorSink output = FileDescriptorSink(STDOUT_FILENO);
+    DiscardingSink discardedTrace = DiscardingSink();
+    bool tracing = !serving && resultFormat == ResultFormat::Text;
+    if (evaluatingRules) {
+        evaluateRules(database, program, tracing ? static_cast<OutputSink&>(output) : discardedTrace, true, options);
+    }
+    
+    if (!savedSnapshotPath.empty() && !saveSnapshot(database, savedSnapshotPath, error)) {
+        output.flush();
+        std::cout << error << std::endl;
+        delete program;
+        for (auto replacedProgram : replacedPrograms) {
+            delete replacedProgram;
+        }
+        delete database;
+        releaseTokens(tokens);
+        return 1;
+    }
+    
+    if (serving) {
+        DatalogServer server = DatalogServer(program, database);
+        if (socketPath.empty()) {
+            server.serve(std::cin, std::cout);
+        } else if (!server.serve(socketPath)) {
+            std::cout << "Could not listen on '" << socketPath << "'." << std::endl;
+        }
+        
+    } else if (resultFormat != ResultFormat::Text) {
+        writeQueryResults(database, program, output, resultFormat, &compiled);
+        output.flush();
+        
+    } else {
+        evaluateQueries(database, program, output, true, &compiled);
+        output << '\n';
+        output.flush();
+    }
     
     // Free our memory.
     if (program != nullptr) {
         delete program;
     }
+    for (auto replacedProgram : replacedPrograms) {
+        delete replacedProgram;
+    }
     delete database;
     releaseTokens(tokens);
     
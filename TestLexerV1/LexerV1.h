@@ -17,5 +17,16 @@
 #import "EvaluatingDatabases.h"
 #import "TestUtils.h"
 #import "DependencyGraph.h"
+#import "ThreadPool.h"
+#import "CompiledProgram.h"
+#import "CodeGenerator.h"
+#import "MagicSets.h"
+#import "IncrementalEvaluator.h"
+#import "DatalogServer.h"
+#import "QueryCache.h"
+#import "OutputSink.h"
+#import "ResultFormats.h"
+#import "FactFiles.h"
+#import "Snapshot.h"
 
 #endif /* LexerV1_h */
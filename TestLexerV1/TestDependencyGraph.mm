@@ -179,7 +179,7 @@
     
     NSError *writeError;
     [string writeToURL:self.workingURL atomically:YES encoding:NSUTF8StringEncoding error:&writeError];
-
+    
     if (writeError != nil) {
         NSLog(@"String write failed to path %@, error: %@", self.workingURL.path, writeError);
         return nil;
@@ -268,6 +268,242 @@
     [self runFactsFromInputFile:20 withPrefix:prefix inDomain:domain]; // This takes a while
 }
 
+- (void)testTestsAcrossThreads {
+    // Independent components and queries run at once, but the output shouldn't change.
+    ThreadPool::setSharedThreadCount(4);
+    [self testBasicTests];
+    [self testExtraTests];
+    ThreadPool::setSharedThreadCount(std::thread::hardware_concurrency());
+}
+
+- (void)testSynchronousPassesAnswerQueriesTheSame {
+    // Passes may be counted differently, but every query should get the same answer.
+    EvaluationOptions options = EvaluationOptions();
+    options.synchronousPasses = true;
+    
+    for (NSString *testID in @[@"50", @"54", @"55", @"56", @"58", @"59", @"61", @"62", @"64"]) {
+        DatalogProgram* program = [self datalogFromInputFileNamed:testID withPrefix:@"in" inDomain:@"Basic Tests"];
+        XCTAssertNotEqual(program, nullptr, "No valid program from in%@.txt", testID);
+        if (program == nullptr) {
+            continue;
+        }
+        
+        Database* sequential = new Database();
+        evaluateSchemes(sequential, program);
+        evaluateFacts(sequential, program);
+        evaluateRules(sequential, program, true);
+        
+        Database* synchronous = new Database();
+        evaluateSchemes(synchronous, program);
+        evaluateFacts(synchronous, program);
+        evaluateRules(synchronous, program, true, options);
+        
+        XCTAssertEqual(evaluateQueries(sequential, program), evaluateQueries(synchronous, program),
+                       "Query answers differ for in%@.txt", testID);
+        
+        delete sequential;
+        delete synchronous;
+    }
+}
+
+- (void)testSynchronousPassesAnswerRulesThatDontFitTheirHeads {
+    // r(B,A) can't be renamed to r's scheme, so that rule empties r. Passes must not race it against the other rule,
+    // whose rows would then be emptied and derived again without end.
+    std::istringstream input = std::istringstream("Schemes: r(A,B) s(A,B)\n"
+                                                  "Facts: r('a','b'). s('b','c'). s('c','d').\n"
+                                                  "Rules: r(B,A) :- r(A,B). r(X,Y) :- s(X,Y),r(Z,W).\n"
+                                                  "Queries: r(X,Y)? r('b',Y)?\n");
+    std::vector<Token*> tokens = collectedTokensFromFile(input);
+    DatalogCheck checker = DatalogCheck();
+    DatalogProgram* program = checker.checkGrammar(tokens);
+    [self releaseAllTokensInVector:tokens];
+    XCTAssertNotEqual(program, nullptr);
+    if (program == nullptr) {
+        return;
+    }
+    
+    EvaluationOptions options = EvaluationOptions();
+    options.synchronousPasses = true;
+    
+    Database* sequential = new Database();
+    evaluateSchemes(sequential, program);
+    evaluateFacts(sequential, program);
+    evaluateRules(sequential, program, true);
+    
+    Database* synchronous = new Database();
+    evaluateSchemes(synchronous, program);
+    evaluateFacts(synchronous, program);
+    evaluateRules(synchronous, program, true, options);
+    
+    XCTAssertEqual(evaluateQueries(sequential, program), evaluateQueries(synchronous, program));
+    XCTAssert(synchronous->relationWithName("r")->getContents() == sequential->relationWithName("r")->getContents());
+    
+    delete program;
+    delete sequential;
+    delete synchronous;
+}
+
+- (void)testMagicSetsAnswerQueriesTheSame {
+    // The rewritten program derives fewer rows, but every query should get the same answer.
+    for (NSString *testID in @[@"50", @"54", @"55", @"56", @"58", @"59", @"61", @"62", @"64"]) {
+        DatalogProgram* program = [self datalogFromInputFileNamed:testID withPrefix:@"in" inDomain:@"Basic Tests"];
+        XCTAssertNotEqual(program, nullptr, "No valid program from in%@.txt", testID);
+        if (program == nullptr) {
+            continue;
+        }
+        
+        DatalogProgram* magicProgram = magicSetsProgram(program);
+        if (magicProgram == nullptr) {
+            // Nothing the queries bind is derived.
+            delete program;
+            continue;
+        }
+        
+        Database* full = new Database();
+        evaluateSchemes(full, program);
+        evaluateFacts(full, program);
+        evaluateRules(full, program, true);
+        
+        Database* demanded = new Database();
+        evaluateSchemes(demanded, magicProgram);
+        evaluateFacts(demanded, magicProgram);
+        evaluateRules(demanded, magicProgram, true);
+        
+        XCTAssertEqual(evaluateQueries(full, program), evaluateQueries(demanded, magicProgram),
+                       "Query answers differ for in%@.txt", testID);
+        
+        delete magicProgram;
+        delete program;
+        delete full;
+        delete demanded;
+    }
+}
+
+- (void)testPruningAnswersQueriesTheSame {
+    // Rules no query depends on are skipped, but every query should get the same answer.
+    for (NSString *testID in @[@"50", @"54", @"55", @"56", @"58", @"59", @"61", @"62", @"64"]) {
+        DatalogProgram* program = [self datalogFromInputFileNamed:testID withPrefix:@"in" inDomain:@"Basic Tests"];
+        XCTAssertNotEqual(program, nullptr, "No valid program from in%@.txt", testID);
+        if (program == nullptr) {
+            continue;
+        }
+        
+        DatalogProgram* prunedProgram = programForQueries(program);
+        XCTAssertLessThanOrEqual(prunedProgram->getRules().size(), program->getRules().size());
+        
+        Database* full = new Database();
+        evaluateSchemes(full, program);
+        evaluateFacts(full, program);
+        evaluateRules(full, program, true);
+        
+        Database* pruned = new Database();
+        evaluateSchemes(pruned, prunedProgram);
+        evaluateFacts(pruned, prunedProgram);
+        evaluateRules(pruned, prunedProgram, true);
+        
+        XCTAssertEqual(evaluateQueries(full, program), evaluateQueries(pruned, prunedProgram),
+                       "Query answers differ for in%@.txt", testID);
+        
+        delete prunedProgram;
+        delete program;
+        delete full;
+        delete pruned;
+    }
+}
+
+- (void)testIncrementalUpdatesMatchRecomputing {
+    for (NSString *testID in @[@"54", @"55", @"61", @"62"]) {
+        DatalogProgram* program = [self datalogFromInputFileNamed:testID withPrefix:@"in" inDomain:@"Basic Tests"];
+        XCTAssertNotEqual(program, nullptr, "No valid program from in%@.txt", testID);
+        if (program == nullptr || program->getFacts().empty()) {
+            continue;
+        }
+        
+        Database* maintained = new Database();
+        evaluateSchemes(maintained, program);
+        evaluateFacts(maintained, program);
+        evaluateRules(maintained, program, true);
+        IncrementalEvaluator evaluator = IncrementalEvaluator(program, maintained);
+        XCTAssert(evaluator.canMaintain(), "in%@.txt should be maintained: %s", testID, evaluator.getUnsupportedReason().c_str());
+        
+        // Swap the first fact for its reverse.
+        Predicate* deleted = program->getFacts().front();
+        std::vector<std::string> items = deleted->getItems();
+        std::reverse(items.begin(), items.end());
+        Predicate* inserted = new Predicate(FACTS, deleted->getIdentifier());
+        inserted->setItems(items);
+        evaluator.update({ inserted }, { deleted });
+        
+        DatalogProgram* updatedProgram = new DatalogProgram();
+        for (auto scheme : program->getSchemes()) {
+            updatedProgram->addScheme(scheme);
+        }
+        for (auto fact : program->getFacts()) {
+            if (fact->getIdentifier() != deleted->getIdentifier() || fact->getItems() != deleted->getItems()) {
+                updatedProgram->addFact(fact);
+            }
+        }
+        updatedProgram->addFact(inserted);
+        for (auto rule : program->getRules()) {
+            updatedProgram->addRule(rule);
+        }
+        
+        Database* recomputed = new Database();
+        evaluateSchemes(recomputed, updatedProgram);
+        evaluateFacts(recomputed, updatedProgram);
+        evaluateRules(recomputed, updatedProgram, true);
+        
+        for (auto relation : recomputed->getRelations()) {
+            XCTAssert(maintained->relationWithName(relation->getName())->getContents() == relation->getContents(),
+                      "%s differs after updating in%@.txt", relation->getName().c_str(), testID);
+        }
+        
+        delete updatedProgram;
+        delete program;
+        delete maintained;
+        delete recomputed;
+    }
+}
+
+- (void)testServerAnswersAsRecomputingWould {
+    DatalogProgram* program = [self datalogFromInputFileNamed:@"55" withPrefix:@"in" inDomain:@"Basic Tests"];
+    XCTAssertNotEqual(program, nullptr, "No valid program from in55.txt");
+    if (program == nullptr || program->getFacts().empty()) {
+        return;
+    }
+    
+    Database* database = new Database();
+    evaluateSchemes(database, program);
+    evaluateFacts(database, program);
+    evaluateRules(database, program, true);
+    DatalogServer server = DatalogServer(program, database);
+    bool isEndingSession = false;
+    
+    // Add a fact of the first fact's relation, then ask each query after updating and after evaluating from scratch.
+    Predicate* fact = program->getFacts().front();
+    std::vector<std::string> items = std::vector<std::string>(fact->getItems().size(), "'added'");
+    Predicate* added = new Predicate(FACTS, fact->getIdentifier());
+    added->setItems(items);
+    
+    XCTAssert(server.respond("add " + added->toString(), isEndingSession) == "Added 1 fact");
+    XCTAssert(server.respond("add " + added->toString(), isEndingSession) == "Added 0 facts");
+    std::string updatedAnswers = server.respond("queries", isEndingSession);
+    server.respond("evaluate", isEndingSession);
+    XCTAssert(server.respond("queries", isEndingSession) == updatedAnswers);
+    
+    for (auto query : program->getQueries()) {
+        std::string answer = server.respond(query->toString(), isEndingSession);
+        XCTAssert(updatedAnswers.find(answer) != std::string::npos, "%s was answered differently", query->toString().c_str());
+    }
+    
+    XCTAssert(server.respond("quit", isEndingSession) == "Goodbye");
+    XCTAssert(isEndingSession);
+    
+    delete added;
+    delete program;
+    delete database;
+}
+
 - (void)testBetterPerformance {
     NSString *domain = @"Basic Tests";
     NSString *prefix = @"in";
@@ -699,7 +935,7 @@
         // Second SCC
         XCTAssert(components.at(1).getNodes().at(4) == graph.getNodes().at(4),
                   "Wrong component at SCC 2. Expected R4.");
-
+        
         // Third SCC
         XCTAssert(components.at(2).getNodes().at(0) == graph.getNodes().at(0),
                   "Wrong first component at SCC 2. Expected R0.");